@@ -0,0 +1,27 @@
+; ALU-heavy loop: register arithmetic with a conditional back edge
+    MOVI A, 1
+    MOVI B, 3
+    MOVI C, 5
+    MOVI D, 7
+    MOVI E, 11
+    MOVI F, 13
+    MOVI G, 17
+    MOVI H, 3
+    MOVI I, 1
+    MOVI J, 0
+loop:
+    ADD A, B
+    MUL C, A
+    XOR D, C
+    SUB E, D
+    SHL F, H
+    OR F, A
+    SHRA G, H
+    AND G, E
+    DIV C, H
+    SHRL D, H
+    ADD G, F
+    ADD J, I
+    CMP J, I
+    JNE loop
+    JMPI loop
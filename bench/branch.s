@@ -0,0 +1,35 @@
+; Branch-heavy code: conditional jumps on pseudo-random bits
+    MOVI A, 0xACE1
+    MOVI E, 7
+    MOVI F, 9
+    MOVI G, 8
+    MOVI H, 1
+    MOVI D, 2
+loop:
+    ; Xorshift the state in A
+    MOV B, A
+    SHL B, E
+    XOR A, B
+    MOV B, A
+    SHRL B, F
+    XOR A, B
+    MOV B, A
+    SHL B, G
+    XOR A, B
+    ; Branch on its two low bits
+    MOV B, A
+    AND B, H
+    JEQ even
+    ADD C, H
+    JMPI next
+even:
+    SUB C, H
+next:
+    MOV B, A
+    AND B, D
+    JNE loop
+    ADD I, H
+    CMP I, C
+    JL loop
+    SUB I, C
+    JMPI loop
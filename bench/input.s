@@ -0,0 +1,14 @@
+; INPUT polling: cycle through eight input IDs and sum their states
+    MOVI B, 0
+    MOVI E, 1
+    MOVI D, 7
+loop:
+    INPUT A, B
+    ADD C, A
+    ADD B, E
+    AND B, D
+    TST A, A
+    JEQ loop
+    COLOR C
+    PIXEL B, B
+    JMPI loop
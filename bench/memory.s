@@ -0,0 +1,25 @@
+; LOAD/STOR memory traffic: copy a buffer back and forth
+    MOVI E, 2
+    MOVI F, 0x0400
+loop:
+    MOVI A, 0x8000
+    MOVI B, 0xA000
+    CALL copy
+    MOVI A, 0xA000
+    MOVI B, 0x8000
+    CALL copy
+    JMPI loop
+
+; Copies F bytes from A to B, adding 1 to every word on the way
+copy:
+    MOV D, A
+    ADD D, F
+copy_loop:
+    LOAD C, A
+    ADD C, E
+    STOR C, B
+    ADD A, E
+    ADD B, E
+    CMP A, D
+    JB copy_loop
+    RET 0
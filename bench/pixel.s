@@ -0,0 +1,20 @@
+; Full-screen PIXEL fills, changing the color every frame
+    MOVI E, 1
+    MOVI F, 0
+    MOVI G, 256
+    MOVI H, 192
+frame:
+    COLOR F
+    MOVI B, 0
+row:
+    MOVI A, 0
+col:
+    PIXEL A, B
+    ADD A, E
+    CMP A, G
+    JB col
+    ADD B, E
+    CMP B, H
+    JB row
+    ADD F, E
+    JMPI frame
@@ -0,0 +1,27 @@
+; Call/return-heavy recursion: naive Fibonacci, over and over
+    MOVI SP, 0x8000
+main:
+    MOVI A, 15
+    CALL fib
+    JMPI main
+
+; Returns fib(A) in B, clobbering A and C
+fib:
+    MOVI C, 2
+    CMP A, C
+    JB fib_base
+    PUSH A
+    MOVI C, 1
+    SUB A, C
+    CALL fib
+    POP A
+    PUSH B
+    MOVI C, 2
+    SUB A, C
+    CALL fib
+    POP C
+    ADD B, C
+    RET 0
+fib_base:
+    MOV B, A
+    RET 0
@@ -0,0 +1,158 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include "batch.h"
+#include "headless.h"
+#include "vidmem.h"
+
+EmuBatch::EmuBatch(const EmuEngine& engine,
+                   const uint64_t& virtual_clock)
+                  : _engine(engine),
+                    _virtualClock(virtual_clock),
+                    _queues(nullptr),
+                    _numQueues(0),
+                    _seconds(0) { }
+
+EmuBatch::~EmuBatch() {
+  delete[] _queues;
+}
+
+bool EmuBatch::loadManifest(const std::string& manifest_filename) {
+  std::ifstream manifest(manifest_filename);
+  if (!manifest.good()) {
+    std::cerr << "Error: Failed to open manifest '"
+              << manifest_filename << "'." << std::endl;
+    return false;
+  }
+  // Each job is a line of the form
+  // ROM INSTRUCTIONS [INPUT_SCRIPT]
+  // and lines that are blank or start with # are skipped
+  std::string line;
+  int line_num = 0;
+  while (std::getline(manifest, line)) {
+    line_num++;
+    std::istringstream iss(line);
+    Job job = Job();
+    if (!(iss >> job.rom) || '#' == job.rom[0]) {
+      continue;
+    }
+    if (!(iss >> job.maxInstructions) || 0 == job.maxInstructions) {
+      std::cerr << "Error: Missing instruction count in "
+                << manifest_filename << " on line " << line_num << "."
+                << std::endl;
+      return false;
+    }
+    iss >> job.inputScript;
+    _jobs.push_back(job);
+  }
+  return true;
+}
+
+void EmuBatch::run(const unsigned& num_threads) {
+  // Deal the jobs out to the workers' queues in turn
+  delete[] _queues;
+  _numQueues = num_threads;
+  _queues = new Queue[_numQueues];
+  for (size_t i = 0; i < _jobs.size(); i++) {
+    _queues[i % _numQueues].jobs.push_back(i);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < _numQueues; i++) {
+    workers.push_back(std::thread(&EmuBatch::_worker, this, i));
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  _seconds = elapsed.count();
+}
+
+void EmuBatch::_worker(const unsigned& index) {
+  size_t job;
+  while (_takeJob(index, job)) {
+    _runJob(_jobs[job]);
+  }
+}
+
+bool EmuBatch::_takeJob(const unsigned& index, size_t& job) {
+  // Take our own most recent job, or else steal the oldest job of
+  // one of the other workers
+  for (unsigned i = 0; i < _numQueues; i++) {
+    Queue& queue = _queues[(index + i) % _numQueues];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.jobs.empty()) {
+      continue;
+    }
+    if (0 == i) {
+      job = queue.jobs.back();
+      queue.jobs.pop_back();
+    } else {
+      job = queue.jobs.front();
+      queue.jobs.pop_front();
+    }
+    return true;
+  }
+  return false;
+}
+
+void EmuBatch::_runJob(Job& job) {
+  auto start = std::chrono::steady_clock::now();
+  EmuVideoMemory vidMem;
+  EmuHeadless headless(&vidMem);
+  EmuProcessor processor(&headless, job.rom);
+  job.ok = !processor.hasError() &&
+           (job.inputScript.empty() ||
+            headless.loadInputScript(job.inputScript));
+  if (job.ok) {
+    processor.setEngine(_engine);
+    // Every run of a job should end up with the same hash
+    processor.setVirtualClock(_virtualClock);
+    processor.setRandomSeed(BATCH_RANDOM_SEED);
+    job.executed = headless.run(&processor, job.maxInstructions, 0);
+    job.hash = vidMem.hash();
+  }
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  job.seconds = elapsed.count();
+}
+
+int EmuBatch::report(std::ostream& out) {
+  // One line per job, in the order of the manifest
+  int failed = 0;
+  uint64_t executed = 0;
+  for (const Job& job : _jobs) {
+    if (job.ok) {
+      out << "ok   0x" << std::hex << std::setw(16) << std::setfill('0')
+          << job.hash << std::dec << std::setfill(' ');
+    } else {
+      out << "FAIL " << std::setw(18) << "-";
+      failed++;
+    }
+    out << std::setw(12) << job.executed << " "
+        << std::setw(9) << std::fixed << std::setprecision(1)
+        << job.seconds * 1000 << "ms " << job.rom;
+    if (!job.inputScript.empty()) {
+      out << " " << job.inputScript;
+    }
+    out << std::endl;
+    executed += job.executed;
+  }
+  out.unsetf(std::ios_base::floatfield);
+  out << std::setprecision(6) << "Jobs: " << _jobs.size() << ", failed: " << failed
+      << ", threads: " << _numQueues << std::endl
+      << "Time: " << _seconds << "s, "
+      << (0 < _seconds ? executed / _seconds / 1e6 : 0) << " MHz in total"
+      << std::endl;
+  return failed;
+}
@@ -0,0 +1,59 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#ifndef EMU_BATCH_H
+#define EMU_BATCH_H
+
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "processor.h"
+#include "defs.h"
+
+// Runs a manifest of headless jobs on a pool of worker threads. Each
+// worker has its own queue of jobs, and steals from the others once
+// its own queue runs dry, so that a few long jobs do not leave the
+// rest of the pool idle.
+class EmuBatch {
+ public:
+  EmuBatch(const EmuEngine& engine, const uint64_t& virtual_clock);
+  ~EmuBatch();
+  bool loadManifest(const std::string& manifest_filename);
+  void run(const unsigned& num_threads);
+  // Returns the number of jobs that failed
+  int report(std::ostream& out);
+
+ private:
+  struct Job {
+    std::string rom;
+    std::string inputScript;
+    uint64_t maxInstructions;
+    bool ok;
+    uint64_t executed;
+    uint64_t hash;
+    double seconds;
+  };
+  // Jobs waiting to run on one worker. The worker takes them from
+  // the back, and other workers steal them from the front.
+  struct Queue {
+    std::mutex mutex;
+    std::deque<size_t> jobs;
+  };
+  void _worker(const unsigned& index);
+  bool _takeJob(const unsigned& index, size_t& job);
+  void _runJob(Job& job);
+
+  EmuEngine _engine;
+  uint64_t _virtualClock;
+  std::vector<Job> _jobs;
+  Queue *_queues;
+  unsigned _numQueues;
+  double _seconds;
+};
+
+#endif
@@ -0,0 +1,216 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include "vidmem.h"
+#include "headless.h"
+#include "processor.h"
+#include "scaler.h"
+
+// Runs the benchmark ROMs headless on each engine for a fixed number
+// of instructions, and times how long each frame scaling kernel takes
+// to present a frame at each scale. The results are printed as JSON.
+
+struct BenchEngine {
+  const char *name;
+  EmuEngine engine;
+};
+
+static const BenchEngine ENGINES[] = {
+  { "switch", ENGINE_SWITCH },
+  { "threaded", ENGINE_THREADED },
+  { "jit", ENGINE_JIT }
+};
+
+static const char *WORKLOADS[] = {
+  "alu", "recursion", "memory", "pixel", "branch", "input"
+};
+
+static const EmuScaleKernel KERNELS[] = {
+  SCALE_KERNEL_SCALAR, SCALE_KERNEL_SSE2, SCALE_KERNEL_AVX2
+};
+
+void usage(std::string program_name) {
+  std::cerr << "Usage: " << program_name << " [OPTIONS] [ROM...]"
+            << std::endl
+            << "Options:" << std::endl
+            << "  --instructions N  Instructions to run each ROM for"
+            << " (default " << BENCH_INSTRUCTIONS << ")" << std::endl
+            << "  --engine NAME     Only run on the engine 'switch',"
+            << " 'threaded' or 'jit'" << std::endl
+            << "  --frames N        Frames to scale with each kernel at"
+            << " each scale (default " << BENCH_SCALE_FRAMES << ")"
+            << std::endl
+            << "Without any ROMs, the workloads in " << BENCH_DIR
+            << " are run." << std::endl;
+}
+
+std::string workload_name(const std::string& rom) {
+  // The file name of the ROM without its directory or extension
+  size_t start = rom.find_last_of('/');
+  start = std::string::npos == start ? 0 : start + 1;
+  size_t end = rom.find_last_of('.');
+  if (std::string::npos == end || end < start) {
+    end = rom.size();
+  }
+  return rom.substr(start, end - start);
+}
+
+bool run_bench(const std::string& rom,
+               const BenchEngine& engine,
+               const uint64_t& instructions,
+               const bool& first) {
+  EmuVideoMemory vidMem;
+  EmuHeadless headless(&vidMem);
+  EmuProcessor processor(&headless, rom);
+  if (processor.hasError()) {
+    return false;
+  }
+  processor.setEngine(engine.engine);
+
+  // Warm up first, so that JIT compilation and cold caches are not
+  // part of the measurement
+  headless.run(&processor, instructions / BENCH_WARMUP_DIVISOR, 0);
+  auto start = std::chrono::steady_clock::now();
+  uint64_t executed = headless.run(&processor, instructions, 0);
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  double seconds = elapsed.count();
+
+  std::cout << (first ? "" : ",") << std::endl
+            << "    {\"workload\": \"" << workload_name(rom) << "\", "
+            << "\"engine\": \"" << engine.name << "\", "
+            << "\"instructions\": " << executed << ", "
+            << "\"seconds\": " << seconds << ", "
+            << "\"instructions_per_second\": " << executed / seconds << ", "
+            << "\"ns_per_instruction\": " << seconds * 1e9 / executed << "}";
+  return true;
+}
+
+bool run_scaling(EmuScaler& scaler,
+                 const uint8_t *frame,
+                 const int& scale,
+                 const int& frames,
+                 const bool& first) {
+  // Scale whole frames into a buffer the size of a window that fits
+  // them exactly, and check the result against the scalar kernel
+  int stride = VIDEO_WIDTH * scale * sizeof(uint32_t);
+  std::vector<uint32_t> pixels(VIDEO_MEMORY_SIZE * scale * scale);
+  std::vector<uint32_t> expected(pixels.size());
+  EmuScaler reference(SCALE_KERNEL_SCALAR);
+  reference.scaleRows(expected.data(), stride, frame, 0, VIDEO_HEIGHT,
+                      scale);
+  scaler.scaleRows(pixels.data(), stride, frame, 0, VIDEO_HEIGHT, scale);
+  if (0 != memcmp(pixels.data(), expected.data(),
+                  pixels.size() * sizeof(uint32_t))) {
+    std::cerr << "Error: The " << scaler.getName() << " kernel scaled a "
+              << "frame by " << scale << " wrong." << std::endl;
+    return false;
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < frames; i++) {
+    scaler.scaleRows(pixels.data(), stride, frame, 0, VIDEO_HEIGHT, scale);
+  }
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  double micros = elapsed.count() * 1e6 / frames;
+
+  std::cout << (first ? "" : ",") << std::endl
+            << "    {\"kernel\": \"" << scaler.getName() << "\", "
+            << "\"scale\": " << scale << ", "
+            << "\"frames\": " << frames << ", "
+            << "\"us_per_frame\": " << micros << ", "
+            << "\"megapixels_per_second\": "
+            << VIDEO_MEMORY_SIZE * scale * scale / micros << "}";
+  return true;
+}
+
+int main(int argc, char **argv) {
+  uint64_t instructions = BENCH_INSTRUCTIONS;
+  int frames = BENCH_SCALE_FRAMES;
+  std::vector<BenchEngine> engines(ENGINES, ENGINES + 3);
+  std::vector<std::string> roms;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if ("--instructions" == arg && hasValue) {
+      instructions = strtoull(argv[++i], nullptr, 0);
+    } else if ("--frames" == arg && hasValue) {
+      frames = strtol(argv[++i], nullptr, 0);
+    } else if ("--engine" == arg && hasValue) {
+      std::string name = argv[++i];
+      engines.clear();
+      for (const BenchEngine& engine : ENGINES) {
+        if (name == engine.name) {
+          engines.push_back(engine);
+        }
+      }
+      if (engines.empty()) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (0 == arg.compare(0, 2, "--")) {
+      usage(argv[0]);
+      return 1;
+    } else {
+      roms.push_back(arg);
+    }
+  }
+  if (0 == instructions || 0 >= frames) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (roms.empty()) {
+    for (const char *workload : WORKLOADS) {
+      roms.push_back(std::string(BENCH_DIR) + "/" + workload + ".bin");
+    }
+  }
+
+  std::cout << "{" << std::endl
+            << "  \"instructions\": " << instructions << "," << std::endl
+            << "  \"results\": [";
+  bool first = true;
+  for (const std::string& rom : roms) {
+    for (const BenchEngine& engine : engines) {
+      if (!run_bench(rom, engine, instructions, first)) {
+        return 1;
+      }
+      first = false;
+    }
+  }
+  std::cout << std::endl << "  ]," << std::endl
+            << "  \"scaling\": [";
+
+  // A frame of every color in a scattered order, so that no kernel
+  // gets an easy ride from runs of one color
+  uint8_t frame[VIDEO_MEMORY_SIZE];
+  uint32_t state = 0x2545f491;
+  for (int i = 0; i < VIDEO_MEMORY_SIZE; i++) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    frame[i] = state >> 24;
+  }
+  first = true;
+  for (const EmuScaleKernel& kernel : KERNELS) {
+    if (!EmuScaler::isSupported(kernel)) {
+      continue;
+    }
+    EmuScaler scaler(kernel);
+    for (int scale = 1; scale <= SCALE_MAX; scale++) {
+      if (!run_scaling(scaler, frame, scale, frames, first)) {
+        return 1;
+      }
+      first = false;
+    }
+  }
+  std::cout << std::endl << "  ]" << std::endl << "}" << std::endl;
+  return 0;
+}
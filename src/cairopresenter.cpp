@@ -0,0 +1,86 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#include <cmath>
+#include "cairopresenter.h"
+
+EmuCairoPresenter::EmuCairoPresenter(Display *display,
+                                     Window window,
+                                     Visual *visual,
+                                     const int& width,
+                                     const int& height)
+                                    : _display(display),
+                                      _cairo(nullptr),
+                                      _width(width),
+                                      _height(height) {
+  // Create the image that video memory is converted into before
+  // being scaled and painted to the window
+  _frame = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+                                      VIDEO_WIDTH,
+                                      VIDEO_HEIGHT);
+
+  // Create the cairo surface we will use for drawing to the window
+  _surface = cairo_xlib_surface_create(
+      _display,     // Connection to the X server
+      window,       // A Drawable, the window in this case
+      visual,       // A Visual, the screen in this case
+      _width,       // The surface width
+      _height       // The surface height
+  );
+  if (nullptr == _surface) {
+    return;
+  }
+
+  // Create the cairo object from the window surface
+  _cairo = cairo_create(_surface);
+}
+
+EmuCairoPresenter::~EmuCairoPresenter() {
+  if (nullptr != _surface) {
+    // Destroy the cairo object
+    cairo_destroy(_cairo);
+    // Destroy the cairo Xlib surface
+    cairo_surface_destroy(_surface);
+  }
+  // Destroy the converted video memory image
+  cairo_surface_destroy(_frame);
+}
+
+bool EmuCairoPresenter::resize(const int& width, const int& height) {
+  _width = width;
+  _height = height;
+  cairo_xlib_surface_set_size(_surface, _width, _height);
+  return true;
+}
+
+void EmuCairoPresenter::present(EmuVideoMemory *vid_mem,
+                                const std::vector<EmuDamage>& damage) {
+  uint32_t *pixels = (uint32_t *)cairo_image_surface_get_data(_frame);
+  int stride = cairo_image_surface_get_stride(_frame);
+  double scaleX = (double)_width / VIDEO_WIDTH;
+  double scaleY = (double)_height / VIDEO_HEIGHT;
+  cairo_surface_flush(_frame);
+  cairo_identity_matrix(_cairo);
+  cairo_new_path(_cairo);
+  for (const EmuDamage& rows : damage) {
+    // Convert the run of damaged rows into the RGB24 frame image
+    vid_mem->convertRows(pixels, stride, rows.firstRow, rows.numRows);
+    cairo_surface_mark_dirty_rectangle(_frame, 0, rows.firstRow,
+                                       VIDEO_WIDTH, rows.numRows);
+    // Clip to the whole window pixels that the rows are scaled onto
+    double top = floor(rows.firstRow * scaleY);
+    double bottom = ceil((rows.firstRow + rows.numRows) * scaleY);
+    cairo_rectangle(_cairo, 0, top, _width, bottom - top);
+  }
+  // Scale and paint the damaged parts of the frame to the window
+  cairo_clip(_cairo);
+  cairo_scale(_cairo, scaleX, scaleY);
+  cairo_set_source_surface(_cairo, _frame, 0, 0);
+  cairo_pattern_set_filter(cairo_get_source(_cairo), CAIRO_FILTER_NEAREST);
+  cairo_paint(_cairo);
+  cairo_reset_clip(_cairo);
+  cairo_surface_flush(_surface);
+  XFlush(_display);
+}
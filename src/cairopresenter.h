@@ -0,0 +1,36 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#ifndef EMU_CAIROPRESENTER_H
+#define EMU_CAIROPRESENTER_H
+
+#include <X11/Xlib.h>
+#include <cairo/cairo.h>
+#include <cairo/cairo-xlib.h>
+#include "presenter.h"
+
+// Converts frames into a cairo image, and lets cairo scale and paint
+// it onto an Xlib surface of the window
+class EmuCairoPresenter : public EmuPresenter {
+ public:
+  EmuCairoPresenter(Display *display, Window window, Visual *visual,
+                    const int& width, const int& height);
+  ~EmuCairoPresenter();
+  bool hasError() { return nullptr == _surface; }
+  const char *getName() { return "cairo"; }
+  bool resize(const int& width, const int& height);
+  void present(EmuVideoMemory *vid_mem,
+               const std::vector<EmuDamage>& damage);
+
+ private:
+  Display *_display;
+  cairo_surface_t *_surface;
+  cairo_surface_t *_frame;
+  cairo_t *_cairo;
+  int _width;
+  int _height;
+};
+
+#endif
@@ -0,0 +1,377 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string.h>
+#include "debugger.h"
+#include "processor.h"
+
+std::atomic<bool> EmuDebugger::_interrupted(false);
+
+// Reads a number in decimal, or in hex with a leading 0x
+static bool parse_number(const std::string& text, uint32_t& out) {
+  char *end;
+  out = strtoul(text.c_str(), &end, 0);
+  return !text.empty() && '\0' == *end;
+}
+
+// Writes a number as hex with at least the given number of digits,
+// without a leading 0x
+static std::string hex(const unsigned& value, const int& digits) {
+  std::ostringstream out;
+  out << std::hex << std::setw(digits) << std::setfill('0') << value;
+  return out.str();
+}
+
+EmuDebugger::EmuDebugger() : _processor(nullptr),
+                             _stopping(true),
+                             _reason(STOP_START),
+                             _stoppedAt(0),
+                             _watchAddr(0) { }
+
+EmuDebugger::~EmuDebugger() {
+  if (nullptr != _processor) {
+    sigaction(SIGINT, &_oldAction, nullptr);
+  }
+}
+
+void EmuDebugger::_onInterrupt(int) {
+  _interrupted = true;
+}
+
+void EmuDebugger::attach(EmuProcessor *processor) {
+  // Ctrl-C stops the processor at the end of the slice it is running,
+  // rather than ending the emulator
+  _processor = processor;
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = &EmuDebugger::_onInterrupt;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, &_oldAction);
+}
+
+void EmuDebugger::stopAt(const uint16_t& addr) {
+  // A watchpoint that asked for the stop has already said why
+  if (!_stopping) {
+    _reason = hasBreakpoint(addr) ? STOP_BREAKPOINT : STOP_INTERRUPT;
+    _stopping = true;
+  }
+  _stoppedAt = addr;
+}
+
+void EmuDebugger::watchHit(const uint16_t& addr) {
+  _reason = STOP_WATCHPOINT;
+  _watchAddr = addr;
+  _stopping = true;
+}
+
+void EmuDebugger::console() {
+  if (!_stopping) {
+    // Only Ctrl-C gets us here without a reason
+    _reason = STOP_INTERRUPT;
+    _stopping = true;
+  }
+  _interrupted = false;
+  _stoppedAt = _processor->_instructionPointer;
+  _showStop();
+  std::string line;
+  while (_stopping && _processor->_running) {
+    // Only Ctrl-C at the prompt quits, not one hit while stepping
+    _interrupted = false;
+    std::cout << "(emu) " << std::flush;
+    if (!_readLine(line)) {
+      std::cout << std::endl;
+      line = "quit";
+    }
+    // An empty line does the last command again
+    if (line.empty()) {
+      line = _lastCommand;
+    } else {
+      _lastCommand = line;
+    }
+    if (!_command(line)) {
+      std::cout << "Unknown command, try 'help'." << std::endl;
+    }
+  }
+}
+
+bool EmuDebugger::_readLine(std::string& line) {
+  // stdin is polled rather than blocked on, so that closing the window
+  // or hitting Ctrl-C at the prompt ends the emulator. Either one, or
+  // the end of stdin, quits.
+  while (true) {
+    size_t end = _input.find('\n');
+    if (std::string::npos != end) {
+      line = _input.substr(0, end);
+      _input.erase(0, end + 1);
+      return true;
+    }
+    if (!_processor->_running || _interrupted) {
+      return false;
+    }
+    struct pollfd fds;
+    fds.fd = STDIN_FILENO;
+    fds.events = POLLIN;
+    if (poll(&fds, 1, DEBUG_POLL_MILLIS) <= 0) {
+      continue;
+    }
+    char buffer[256];
+    ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer));
+    if (n < 0 && EINTR == errno) {
+      continue;
+    } else if (n <= 0) {
+      // A last line without a newline still counts
+      line = _input;
+      _input.clear();
+      return !line.empty();
+    }
+    _input.append(buffer, n);
+  }
+}
+
+bool EmuDebugger::_command(const std::string& line) {
+  std::istringstream in(line);
+  std::string name, first, second;
+  in >> name >> first >> second;
+  uint32_t arg1 = 0, arg2 = 0;
+  bool hasArg1 = parse_number(first, arg1);
+  bool hasArg2 = parse_number(second, arg2);
+  if (!first.empty() && !hasArg1) {
+    return false;
+  }
+
+  if ("s" == name || "step" == name) {
+    _reason = STOP_STEP;
+    _step(hasArg1 ? arg1 : 1);
+    _showStop();
+  } else if ("c" == name || "continue" == name) {
+    _resume();
+  } else if (("b" == name || "break" == name) && hasArg1) {
+    _setBreakpoint(arg1);
+  } else if (("w" == name || "watch" == name) && hasArg1) {
+    _setWatchpoint(arg1);
+  } else if (("d" == name || "delete" == name) && hasArg1) {
+    _delete(arg1);
+  } else if ("i" == name || "info" == name) {
+    for (uint16_t addr : _breakpoints) {
+      std::cout << "Breakpoint 0x" << hex(addr, 4) << std::endl;
+    }
+    for (uint16_t addr : _watchpoints) {
+      std::cout << "Watchpoint 0x" << hex(addr, 4) << std::endl;
+    }
+  } else if ("r" == name || "regs" == name) {
+    _showRegisters();
+  } else if (("x" == name || "memory" == name) && hasArg1) {
+    _showMemory(arg1, hasArg2 ? arg2 : DEBUG_DUMP_BYTES);
+  } else if ("l" == name || "list" == name) {
+    _showInstructions(hasArg1 ? arg1 : _processor->_instructionPointer,
+                      hasArg2 ? arg2 : DEBUG_LIST_INSTRUCTIONS);
+  } else if ("q" == name || "quit" == name) {
+    _processor->_running = false;
+    std::cout << "The processor has stopped." << std::endl;
+  } else if ("h" == name || "help" == name) {
+    std::cout
+      << "step [N]         Run N instructions (default 1)" << std::endl
+      << "continue         Run until something stops the processor"
+      << std::endl
+      << "break ADDR       Stop before the instruction at ADDR runs"
+      << std::endl
+      << "watch ADDR       Stop after a write to the byte at ADDR"
+      << std::endl
+      << "delete ADDR      Remove the breakpoint and watchpoint at ADDR"
+      << std::endl
+      << "info             List breakpoints and watchpoints" << std::endl
+      << "regs             Show the registers and flags" << std::endl
+      << "memory ADDR [N]  Show N bytes of memory from ADDR" << std::endl
+      << "list [ADDR] [N]  Disassemble N instructions from ADDR"
+      << std::endl
+      << "quit             Stop the processor" << std::endl
+      << "Commands can be shortened to their first letter, or 'x' for"
+      << " memory. An empty" << std::endl
+      << "line does the last command again, and Ctrl-C stops a running"
+      << " processor." << std::endl;
+  } else {
+    return false;
+  }
+  std::cout << std::flush;
+  return true;
+}
+
+void EmuDebugger::_step(const uint64_t& count) {
+  // Steps run on the switch engine, which doesn't look at the
+  // predecoded slots and so doesn't stop at breakpoints by itself
+  for (uint64_t i = 0; i < count; i++) {
+    if (0 < i && hasBreakpoint(_processor->_instructionPointer)) {
+      _reason = STOP_BREAKPOINT;
+      break;
+    }
+    _processor->_step();
+    if (STOP_WATCHPOINT == _reason) {
+      break;
+    }
+  }
+  _stoppedAt = _processor->_instructionPointer;
+  _processor->_vidMem->publishIfRequested();
+}
+
+void EmuDebugger::_resume() {
+  // Step past the instruction we stopped at, which may have a
+  // breakpoint, then have every slot decoded again, since the ones
+  // decoded while we were stopping were decoded to stop
+  _reason = STOP_STEP;
+  _step(1);
+  if (STOP_WATCHPOINT == _reason) {
+    _showStop();
+    return;
+  }
+  for (int slot = 0; slot < MAIN_MEMORY_SIZE / INST_SIZE; slot++) {
+    _processor->_decoded[slot].handler = OPCODE_DECODE;
+  }
+  _stopping = false;
+}
+
+void EmuDebugger::_redecode(const uint16_t& addr) {
+  // The slot before may have been fused with this one, so it goes too
+  _processor->_decoded[addr / INST_SIZE].handler = OPCODE_DECODE;
+  _processor->_decoded[(uint16_t)(addr - INST_SIZE) / INST_SIZE].handler =
+    OPCODE_DECODE;
+}
+
+void EmuDebugger::_setBreakpoint(const uint16_t& addr) {
+  uint16_t slotAddr = addr & 0xfffc;
+  _breakpoints.insert(slotAddr);
+  _redecode(slotAddr);
+  std::cout << "Breakpoint 0x" << hex(slotAddr, 4) << std::endl;
+}
+
+void EmuDebugger::_setWatchpoint(const uint16_t& addr) {
+  _watchpoints.insert(addr);
+  _processor->_pageFlags[addr / MEMORY_PAGE_SIZE] |= PAGE_FLAG_WATCH;
+  std::cout << "Watchpoint 0x" << hex(addr, 4) << std::endl;
+}
+
+void EmuDebugger::_delete(const uint16_t& addr) {
+  if (0 != _breakpoints.erase(addr & 0xfffc)) {
+    _redecode(addr & 0xfffc);
+    std::cout << "Deleted breakpoint 0x" << hex(addr & 0xfffc, 4)
+              << std::endl;
+  }
+  if (0 != _watchpoints.erase(addr)) {
+    // Stores to the page only go through the hook while it has
+    // watchpoints left
+    uint16_t page = addr / MEMORY_PAGE_SIZE;
+    auto next = _watchpoints.lower_bound(page * MEMORY_PAGE_SIZE);
+    if (_watchpoints.end() == next || page != *next / MEMORY_PAGE_SIZE) {
+      _processor->_pageFlags[page] &= ~PAGE_FLAG_WATCH;
+    }
+    std::cout << "Deleted watchpoint 0x" << hex(addr, 4) << std::endl;
+  }
+}
+
+void EmuDebugger::_showStop() {
+  switch (_reason) {
+  case STOP_START:
+    std::cout << "Stopped before the first instruction, type 'help' for"
+              << " commands." << std::endl;
+    break;
+  case STOP_BREAKPOINT:
+    std::cout << "Breakpoint 0x" << hex(_stoppedAt, 4) << std::endl;
+    break;
+  case STOP_WATCHPOINT:
+    std::cout << "Watchpoint 0x" << hex(_watchAddr, 4) << " written, now 0x"
+              << hex(_processor->_mainMem[_watchAddr], 2) << std::endl;
+    break;
+  case STOP_INTERRUPT:
+    std::cout << "Interrupted" << std::endl;
+    break;
+  case STOP_STEP:
+  default:
+    break;
+  }
+  _showInstructions(_stoppedAt, 1);
+}
+
+void EmuDebugger::_showRegisters() {
+  for (int i = 0; i < NUM_REGISTERS; i++) {
+    std::cout << std::setw(2) << EMU_REGISTERS[i] << "=0x"
+              << hex(_processor->_registers[i], 4)
+              << (3 == i % 4 ? "\n" : "  ");
+  }
+  std::cout << "IP=0x" << hex(_processor->_instructionPointer, 4)
+            << "  COLOR=0x" << hex(_processor->_colorRegister, 2)
+            << "  FLAGS=" << (_processor->_carryFlag() ? 'C' : '-')
+            << (_processor->_zeroFlag() ? 'Z' : '-')
+            << (_processor->_signFlag() ? 'S' : '-')
+            << (_processor->_overflowFlag() ? 'O' : '-')
+            << "  instructions=" << _processor->_instructionCount
+            << std::endl;
+}
+
+void EmuDebugger::_showMemory(const uint16_t& addr, const uint32_t& count) {
+  // Sixteen bytes a line, wrapping around the end of memory
+  for (uint32_t i = 0; i < count; i++) {
+    uint16_t at = addr + i;
+    if (0 == i % 16) {
+      std::cout << (0 == i ? "" : "\n") << "0x" << hex(at, 4) << ":";
+    }
+    std::cout << " " << hex(_processor->_mainMem[at], 2);
+  }
+  std::cout << std::endl;
+}
+
+void EmuDebugger::_showInstructions(uint16_t addr, const uint32_t& count) {
+  // The instruction about to run is marked with an arrow, and
+  // breakpoints with a star
+  addr &= 0xfffc;
+  for (uint32_t i = 0; i < count; i++, addr += INST_SIZE) {
+    const uint8_t *inst = &_processor->_mainMem[addr];
+    std::cout << (_processor->_instructionPointer == addr ? "=>" : "  ")
+              << (hasBreakpoint(addr) ? '*' : ' ') << " 0x" << hex(addr, 4)
+              << "  " << hex(inst[0], 2) << " " << hex(inst[1], 2) << " "
+              << hex(inst[2], 2) << " " << hex(inst[3], 2) << "  "
+              << _disassemble(addr) << std::endl;
+  }
+}
+
+std::string EmuDebugger::_disassemble(const uint16_t& addr) {
+  const uint8_t *inst = &_processor->_mainMem[addr];
+  if (OPCODE_JNS < inst[0]) {
+    return "???";
+  }
+  const EmuOpcodeInfo& info = EMU_ISA[inst[0]];
+  const char *reg1 = EMU_REGISTERS[inst[1] & 0xf];
+  const char *reg2 = EMU_REGISTERS[inst[2] & 0xf];
+  if (OPERANDS_NONE == info.operands) {
+    return info.mnemonic;
+  }
+  std::ostringstream text;
+  text << std::left << std::setw(7) << info.mnemonic << " ";
+  switch (info.operands) {
+  case OPERANDS_REG:
+    text << reg1;
+    break;
+  case OPERANDS_REG_REG:
+    text << reg1 << ", " << reg2;
+    break;
+  case OPERANDS_REG_IMM:
+    text << reg1 << ", 0x" << hex((inst[2] << 8) | inst[3], 4);
+    break;
+  case OPERANDS_ADDR:
+    text << "0x" << hex((inst[1] << 8) | inst[2], 4);
+    break;
+  case OPERANDS_COUNT:
+  default:
+    text << (unsigned)inst[1];
+    break;
+  }
+  return text.str();
+}
@@ -0,0 +1,87 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#ifndef EMU_DEBUGGER_H
+#define EMU_DEBUGGER_H
+
+#include <signal.h>
+#include <stdint.h>
+#include <atomic>
+#include <set>
+#include <string>
+#include "defs.h"
+
+class EmuProcessor;
+
+// Why the debugger stopped the processor
+enum EmuStopReason {
+  STOP_START,
+  STOP_BREAKPOINT,
+  STOP_WATCHPOINT,
+  STOP_INTERRUPT,
+  STOP_STEP
+};
+
+// An interactive debugger that takes commands on stdin. It stops the
+// processor before the first instruction, at breakpoints, after
+// writes to watched addresses and on Ctrl-C, and lets it go again when
+// told to. Breakpoints are put into the predecoded instruction slots
+// and watchpoints are page flags, so instructions that don't hit one
+// check nothing.
+class EmuDebugger {
+ public:
+  EmuDebugger();
+  ~EmuDebugger();
+
+  // Processor side
+  void attach(EmuProcessor *processor);
+  bool isStopping() { return _stopping || _interrupted; }
+  bool hasBreakpoint(const uint16_t& addr) {
+    return 0 != _breakpoints.count(addr);
+  }
+  // Whether the slot at addr should be decoded to stop the processor
+  bool breaksAt(const uint16_t& addr) {
+    return isStopping() || hasBreakpoint(addr);
+  }
+  bool isWatched(const uint16_t& addr) {
+    return 0 != _watchpoints.count(addr);
+  }
+  // The processor reached a slot decoded to stop it
+  void stopAt(const uint16_t& addr);
+  void watchHit(const uint16_t& addr);
+  // Takes commands until told to carry on
+  void console();
+
+ private:
+  static void _onInterrupt(int);
+  bool _readLine(std::string& line);
+  bool _command(const std::string& line);
+  void _step(const uint64_t& count);
+  void _resume();
+  void _redecode(const uint16_t& addr);
+  void _setBreakpoint(const uint16_t& addr);
+  void _setWatchpoint(const uint16_t& addr);
+  void _delete(const uint16_t& addr);
+  void _showStop();
+  void _showRegisters();
+  void _showMemory(const uint16_t& addr, const uint32_t& count);
+  void _showInstructions(uint16_t addr, const uint32_t& count);
+  std::string _disassemble(const uint16_t& addr);
+
+  static std::atomic<bool> _interrupted;
+  EmuProcessor *_processor;
+  struct sigaction _oldAction;
+  bool _stopping;
+  EmuStopReason _reason;
+  uint16_t _stoppedAt;
+  uint16_t _watchAddr;
+  std::set<uint16_t> _breakpoints;
+  std::set<uint16_t> _watchpoints;
+  std::string _lastCommand;
+  // Read from stdin but not yet taken as a command
+  std::string _input;
+};
+
+#endif
@@ -11,11 +11,107 @@
 #define DEFAULT_WINDOW_SCALE 3
 #define DEFAULT_WINDOW_WIDTH (VIDEO_WIDTH * DEFAULT_WINDOW_SCALE)
 #define DEFAULT_WINDOW_HEIGHT (VIDEO_HEIGHT * DEFAULT_WINDOW_SCALE)
+// The largest whole number that frames are scaled up by
+#define SCALE_MAX 8
+#define VIDEO_MEMORY_SIZE (VIDEO_WIDTH * VIDEO_HEIGHT)
 
 #define MAIN_MEMORY_SIZE 65536
+// Marks the shared frame buffer as not yet acquired by the presenter
+#define VIDEO_FRAME_NEW 0x4
+
+#define MEMORY_PAGE_SIZE 256
 #define NUM_REGISTERS 16
 #define INST_SIZE 4
 
+// Flags for pages of main memory that need attention when written
+#define PAGE_FLAG_JIT 0x01
+#define PAGE_FLAG_WATCH 0x02
+#define PAGE_FLAG_REWIND 0x04
+
+// Number of instructions run between checks of the running flag
+#define EXECUTE_SLICE 10000
+
+// Target length of a slice when running at a fixed clock rate, and
+// how far behind the target we can fall before giving up on it
+#define PACE_SLICE_MICROS 1000
+#define PACE_MAX_LAG_MICROS 100000
+
+// The most instructions in a loop that can be recognized as waiting
+// on TIME or INPUT, and how many to run after waking from one before
+// checking whether it is still waiting
+#define IDLE_MAX_LOOP 16
+#define IDLE_PROBE_SLICE 64
+
+// Calls deeper than this are not tracked separately by the profiler,
+// and the number of rows in each table of its report
+#define PROFILE_MAX_DEPTH 256
+#define PROFILE_REPORT_ROWS 20
+
+// Identifies save state files and the version of their layout
+#define SAVE_STATE_MAGIC "CONSAVE"
+#define SAVE_STATE_VERSION 3
+
+// Identifies trace files and the version of their layout, the
+// instructions in each chunk of raw records handed to the trace
+// writer, the chunks that can be waiting for it, how long either side
+// sleeps while waiting for the other, and the records the trace
+// decoder reads at a time
+#define TRACE_MAGIC "CONTRACE"
+#define TRACE_VERSION 3
+#define TRACE_CHUNK_RECORDS (1 << 17)
+#define TRACE_NUM_CHUNKS 16
+#define TRACE_WAIT_MICROS 1000
+#define TRACE_READ_SIZE (1 << 17)
+
+// What the debugger shows when not told how much: the bytes of
+// memory it dumps, and the instructions it disassembles. Then how
+// often the prompt looks up from stdin to see if the emulator is
+// shutting down.
+#define DEBUG_DUMP_BYTES 64
+#define DEBUG_LIST_INSTRUCTIONS 8
+#define DEBUG_POLL_MILLIS 100
+
+// Rewind checkpoints per second of TIME, the checkpoints to each
+// keyframe, how long the processor sleeps while held on one, and the
+// key that steps back
+#define REWIND_FRAMES 60
+#define REWIND_KEYFRAME_INTERVAL 60
+#define REWIND_WAIT_MICROS 1000
+#define REWIND_KEY "BackSpace"
+
+// Instructions per millisecond of the virtual clock, unless told
+// otherwise
+#define DEFAULT_VIRTUAL_CLOCK 10000
+
+// The RND seed of every batch job, so that they can be repeated
+#define BATCH_RANDOM_SEED 0x2545f491
+
+// Defaults for the benchmark harness
+#define BENCH_DIR "bench"
+#define BENCH_INSTRUCTIONS 200000000
+#define BENCH_WARMUP_DIVISOR 20
+#define BENCH_SCALE_FRAMES 200
+
+#define NUM_INPUT_IDS 65536
+// X keycodes fit in a byte
+#define NUM_KEYCODES 256
+
+#define DEFAULT_REFRESH_RATE 60
+#define CACHE_LINE_SIZE 64
+// How often telemetry is published, the buckets of its histogram of
+// draw times, the clients that can wait to connect to its socket, the
+// longest line it writes, and where the overlay text starts
+#define TELEMETRY_PERIOD_MILLIS 1000
+#define TELEMETRY_DRAW_BUCKETS 16
+#define TELEMETRY_MAX_CLIENTS 8
+#define TELEMETRY_LINE_SIZE 512
+#define TELEMETRY_OVERLAY_X 4
+#define TELEMETRY_OVERLAY_Y 14
+// Frames that can wait for the recording writer before frames are
+// dropped, frames it writes at once, and how long it sleeps when idle
+#define RECORD_QUEUE_FRAMES 32
+#define RECORD_BUFFER_FRAMES 16
+#define RECORD_IDLE_MICROS 2000
 #define DEFAULT_KEYMAP_FILENAME "keys.txt"
 
 #define OPCODE_NOP   0x00
@@ -64,6 +160,20 @@
 #define OPCODE_JS    0x3E
 #define OPCODE_JNS   0x3F
 
+// Not a real opcode, marks a predecoded slot that needs decoding
+#define OPCODE_DECODE 0x40
+// Nor are these, they mark slots that run together with the slot
+// after them as one superinstruction. CMP and TST have one for each
+// conditional jump from JEQ, MOVI has one for each ALU opcode from ADD.
+#define OPCODE_FUSED_CMP       0x41
+#define OPCODE_FUSED_TST       0x4F
+#define OPCODE_FUSED_MOVI      0x5D
+#define OPCODE_FUSED_LOAD_ADD  0x69
+#define OPCODE_FUSED_PUSH_CALL 0x6A
+// Marks a slot that the debugger stops at before it runs
+#define OPCODE_BREAK           0x6B
+#define NUM_HANDLERS           0x6C
+
 #define REG_SP 0x0
 #define REG_FP 0x1
 #define REG_A  0x2
@@ -6,12 +6,78 @@
 #include <X11/Xlib.h>
 #include <thread>
 #include <iostream>
+#include <iomanip>
+#include <memory>
+#include <vector>
+#include <stdlib.h>
 #include "vidmem.h"
 #include "window.h"
+#include "headless.h"
 #include "processor.h"
+#include "profiler.h"
+#include "batch.h"
+#include "recorder.h"
+#include "tracer.h"
+#include "debugger.h"
+#include "rewind.h"
+#include "telemetry.h"
 
 void usage(std::string program_name) {
-  std::cerr << "Usage: " << program_name << " INFILE [KEYMAP]" << std::endl;
+  std::cerr << "Usage: " << program_name << " [OPTIONS] INFILE [KEYMAP]"
+            << std::endl
+            << "       " << program_name << " [OPTIONS] --batch MANIFEST"
+            << std::endl
+            << "Options:" << std::endl
+            << "  --engine NAME        Engine to run with, 'threaded'"
+            << " (default), 'switch' or 'jit'" << std::endl
+            << "  --jit                Same as --engine jit" << std::endl
+            << "  --present NAME       Present frames with 'shm' (default"
+            << " if available) or 'cairo'" << std::endl
+            << "  --refresh HZ         Present frames HZ times a second"
+            << " (default " << DEFAULT_REFRESH_RATE << ")" << std::endl
+            << "  --record FILE        Record the frames shown to FILE, as"
+            << " Y4M if it ends in .y4m" << std::endl
+            << "  --headless           Run without a window" << std::endl
+            << "  --instructions N     Stop after N instructions"
+            << " (headless)" << std::endl
+            << "  --millis N           Stop after N milliseconds"
+            << " (headless)" << std::endl
+            << "  --input-script FILE  Read timed input events from FILE"
+            << " (headless)" << std::endl
+            << "  --dump FILE          Write the final frame to FILE as a"
+            << " PPM image (headless)" << std::endl
+            << "  --mhz N              Run at N million instructions per"
+            << " second (default: unlimited)" << std::endl
+            << "  --profile FILE       Profile the run, writing folded"
+            << " call stacks to FILE" << std::endl
+            << "  --trace FILE         Trace every instruction to FILE"
+            << std::endl
+            << "  --debug              Debug the ROM with commands from"
+            << " stdin" << std::endl
+            << "  --rewind MB          Keep MB megabytes of history to"
+            << " step back through," << std::endl
+            << "                       a frame each time " << REWIND_KEY
+            << " is pressed" << std::endl
+            << "  --stats DEST         Publish performance counters every"
+            << " second to a file," << std::endl
+            << "                       or to a socket with unix:PATH"
+            << std::endl
+            << "  --stats-overlay      Show performance counters over the"
+            << " frame" << std::endl
+            << "  --virtual-clock N    Count time as N instructions per"
+            << " millisecond" << std::endl
+            << "  --turbo              Run on the virtual clock as fast as"
+            << " possible" << std::endl
+            << "  --busy-wait          Spin in loops that wait on TIME or"
+            << " INPUT instead of sleeping" << std::endl
+            << "  --load-state FILE    Start from the save state in FILE"
+            << std::endl
+            << "  --save-state FILE    Write a save state to FILE on exit"
+            << std::endl
+            << "  --batch MANIFEST     Run the headless jobs listed in"
+            << " MANIFEST in parallel" << std::endl
+            << "  --threads N          Worker threads for --batch"
+            << " (default: one per core)" << std::endl;
 }
 
 void win_thread_start(EmuWindow *window) {
@@ -22,25 +88,352 @@ void proc_thread_start(EmuProcessor *processor) {
   processor->execute();
 }
 
+// Options from the command line
+struct EmuOptions {
+  bool headless;
+  EmuEngine engine;
+  uint64_t maxInstructions;
+  uint64_t maxMillis;
+  double mhz;
+  uint64_t virtualClock;
+  bool turbo;
+  bool busyWait;
+  std::string inputScript;
+  std::string dumpFile;
+  std::string profileFile;
+  std::string traceFile;
+  bool debug;
+  size_t rewindMegabytes;
+  std::string statsDestination;
+  bool statsOverlay;
+  std::string loadStateFile;
+  std::string saveStateFile;
+  EmuPresentMode presentMode;
+  double refreshRate;
+  std::string recordFile;
+  std::string batchManifest;
+  unsigned batchThreads;
+};
+
+bool start_processor(EmuProcessor *processor,
+                     const EmuOptions& options,
+                     EmuProfiler *profiler,
+                     EmuTracer *tracer,
+                     EmuDebugger *debugger,
+                     EmuTelemetry *telemetry) {
+  // Set up the processor to run as the options say
+  processor->setEngine(options.engine);
+  processor->setVirtualClock(options.virtualClock);
+  processor->setTargetRate(options.mhz);
+  processor->setIdleSleep(!options.busyWait);
+  processor->setProfiler(profiler);
+  processor->setTelemetry(telemetry);
+  if (!options.loadStateFile.empty() &&
+      !processor->loadState(options.loadStateFile)) {
+    return false;
+  }
+  // The trace starts from wherever the processor starts
+  processor->setTracer(tracer);
+  processor->setDebugger(debugger);
+  return true;
+}
+
+int finish_processor(EmuProcessor *processor,
+                     const EmuOptions& options,
+                     EmuProfiler *profiler,
+                     EmuTracer *tracer,
+                     EmuTelemetry *telemetry) {
+  // Report on fusion, and write out anything asked for once the
+  // processor has stopped
+  int status = 0;
+  uint64_t threaded = processor->getThreadedCount();
+  if (0 < threaded) {
+    std::cout << "Fused: " << processor->getFusedCount() << " of "
+              << threaded << " instructions ("
+              << 100.0 * processor->getFusedCount() / threaded << "%)"
+              << std::endl;
+  }
+  if (!options.saveStateFile.empty() &&
+      !processor->saveState(options.saveStateFile)) {
+    status = 1;
+  }
+  if (profiler) {
+    profiler->report(std::cout);
+    if (!profiler->writeFoldedStacks(options.profileFile)) {
+      status = 1;
+    }
+  }
+  if (tracer) {
+    if (!tracer->finish()) {
+      status = 1;
+    }
+    tracer->report(std::cout);
+  }
+  if (telemetry && !telemetry->stop()) {
+    status = 1;
+  }
+  return status;
+}
+
+int run_headless(const std::string& infile,
+                 const EmuOptions& options,
+                 EmuProfiler *profiler,
+                 EmuTracer *tracer,
+                 EmuDebugger *debugger,
+                 EmuTelemetry *telemetry) {
+  EmuVideoMemory vidMem;
+  EmuHeadless headless(&vidMem);
+  EmuProcessor processor(&headless, infile);
+  if (processor.hasError() ||
+      !start_processor(&processor, options, profiler, tracer, debugger,
+                       telemetry)) {
+    return 1;
+  }
+  if (!options.inputScript.empty() &&
+      !headless.loadInputScript(options.inputScript)) {
+    return 1;
+  }
+
+  uint64_t executed = headless.run(&processor, options.maxInstructions,
+                                   options.maxMillis);
+
+  std::cout << "Instructions: " << executed << std::endl
+            << "Rate: " << headless.getAchievedRate() << " MHz" << std::endl
+            << "Frame hash: 0x" << std::hex << std::setw(16)
+            << std::setfill('0') << vidMem.hash() << std::dec << std::endl;
+  if (!options.dumpFile.empty() && !headless.dumpFrame(options.dumpFile)) {
+    return 1;
+  }
+  return finish_processor(&processor, options, profiler, tracer, telemetry);
+}
+
+int run_batch(const EmuOptions& options) {
+  // Batch jobs always run on the virtual clock and as fast as they
+  // can, so that they finish with the same hash every time
+  EmuBatch batch(options.engine, 0 != options.virtualClock ?
+                                 options.virtualClock :
+                                 DEFAULT_VIRTUAL_CLOCK);
+  if (!batch.loadManifest(options.batchManifest)) {
+    return 1;
+  }
+  batch.run(0 < options.batchThreads ? options.batchThreads : 1);
+  return 0 == batch.report(std::cout) ? 0 : 1;
+}
+
 int main(int argc, char **argv) {
-  if (2 != argc && 3 != argc) {
+  EmuOptions options;
+  options.headless = false;
+  options.engine = ENGINE_THREADED;
+  options.maxInstructions = 0;
+  options.maxMillis = 0;
+  options.mhz = 0;
+  options.virtualClock = 0;
+  options.turbo = false;
+  options.busyWait = false;
+  options.debug = false;
+  options.rewindMegabytes = 0;
+  options.statsOverlay = false;
+  options.presentMode = PRESENT_AUTO;
+  options.refreshRate = DEFAULT_REFRESH_RATE;
+  options.batchThreads = std::thread::hardware_concurrency();
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if ("--engine" == arg && hasValue) {
+      std::string name = argv[++i];
+      if ("switch" == name) {
+        options.engine = ENGINE_SWITCH;
+      } else if ("threaded" == name) {
+        options.engine = ENGINE_THREADED;
+      } else if ("jit" == name) {
+        options.engine = ENGINE_JIT;
+      } else {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if ("--present" == arg && hasValue) {
+      std::string name = argv[++i];
+      if ("shm" == name) {
+        options.presentMode = PRESENT_SHM;
+      } else if ("cairo" == name) {
+        options.presentMode = PRESENT_CAIRO;
+      } else {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if ("--refresh" == arg && hasValue) {
+      options.refreshRate = strtod(argv[++i], nullptr);
+      if (0 >= options.refreshRate) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if ("--record" == arg && hasValue) {
+      options.recordFile = argv[++i];
+    } else if ("--jit" == arg) {
+      options.engine = ENGINE_JIT;
+    } else if ("--headless" == arg) {
+      options.headless = true;
+    } else if ("--instructions" == arg && hasValue) {
+      options.maxInstructions = strtoull(argv[++i], nullptr, 0);
+    } else if ("--millis" == arg && hasValue) {
+      options.maxMillis = strtoull(argv[++i], nullptr, 0);
+    } else if ("--input-script" == arg && hasValue) {
+      options.inputScript = argv[++i];
+    } else if ("--dump" == arg && hasValue) {
+      options.dumpFile = argv[++i];
+    } else if ("--profile" == arg && hasValue) {
+      options.profileFile = argv[++i];
+    } else if ("--trace" == arg && hasValue) {
+      options.traceFile = argv[++i];
+    } else if ("--debug" == arg) {
+      options.debug = true;
+    } else if ("--rewind" == arg && hasValue) {
+      options.rewindMegabytes = strtoul(argv[++i], nullptr, 0);
+      if (0 == options.rewindMegabytes) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if ("--stats" == arg && hasValue) {
+      options.statsDestination = argv[++i];
+    } else if ("--stats-overlay" == arg) {
+      options.statsOverlay = true;
+    } else if ("--mhz" == arg && hasValue) {
+      options.mhz = strtod(argv[++i], nullptr);
+    } else if ("--virtual-clock" == arg && hasValue) {
+      options.virtualClock = strtoull(argv[++i], nullptr, 0);
+    } else if ("--turbo" == arg) {
+      options.turbo = true;
+    } else if ("--busy-wait" == arg) {
+      options.busyWait = true;
+    } else if ("--load-state" == arg && hasValue) {
+      options.loadStateFile = argv[++i];
+    } else if ("--save-state" == arg && hasValue) {
+      options.saveStateFile = argv[++i];
+    } else if ("--batch" == arg && hasValue) {
+      options.batchManifest = argv[++i];
+    } else if ("--threads" == arg && hasValue) {
+      options.batchThreads = strtoul(argv[++i], nullptr, 0);
+    } else if (0 == arg.compare(0, 2, "--")) {
+      usage(argv[0]);
+      return 1;
+    } else {
+      args.push_back(arg);
+    }
+  }
+  if (options.turbo && 0 == options.virtualClock) {
+    options.virtualClock = DEFAULT_VIRTUAL_CLOCK;
+  }
+  if (0 != options.virtualClock && !options.turbo && 0 == options.mhz) {
+    // Run at the rate that keeps virtual time in step with real time
+    options.mhz = options.virtualClock / 1000.0;
+  }
+
+  if (!options.batchManifest.empty()) {
+    if (!args.empty()) {
+      usage(argv[0]);
+      return 1;
+    }
+    return run_batch(options);
+  }
+  if (1 != args.size() && 2 != args.size()) {
     usage(argv[0]);
     return 1;
   }
 
+  // Profiling and tracing are opt-in, and cost nothing when they are
+  // off. Profiling runs on the switch engine and tracing on the
+  // threaded one, so only one can be on at a time.
+  std::unique_ptr<EmuProfiler> profiler;
+  if (!options.profileFile.empty()) {
+    profiler.reset(new EmuProfiler());
+  }
+  std::unique_ptr<EmuTracer> tracer;
+  if (!options.traceFile.empty()) {
+    if (profiler) {
+      std::cerr << "Error: Cannot profile and trace at the same time."
+                << std::endl;
+      return 1;
+    }
+    tracer.reset(new EmuTracer(options.traceFile));
+    if (tracer->hasError()) {
+      return 1;
+    }
+  }
+  // The debugger needs breakpoints in the threaded engine's slots, and
+  // every instruction it stops at would throw off a profile or trace
+  std::unique_ptr<EmuDebugger> debugger;
+  if (options.debug) {
+    if (profiler || tracer) {
+      std::cerr << "Error: Cannot debug while profiling or tracing."
+                << std::endl;
+      return 1;
+    }
+    debugger.reset(new EmuDebugger());
+  }
+  // Stepping back would leave gaps in a profile or trace, and the
+  // debugger has its own way of stopping
+  if (0 < options.rewindMegabytes) {
+    if (profiler || tracer || debugger) {
+      std::cerr << "Error: Cannot rewind while profiling, tracing or "
+                << "debugging." << std::endl;
+      return 1;
+    } else if (options.headless) {
+      std::cerr << "Error: Rewinding needs a window." << std::endl;
+      return 1;
+    }
+  }
+  std::unique_ptr<EmuTelemetry> telemetry;
+  if (!options.statsDestination.empty() || options.statsOverlay) {
+    telemetry.reset(new EmuTelemetry(options.statsDestination));
+    if (telemetry->hasError()) {
+      return 1;
+    }
+  }
+
+  if (options.headless) {
+    if (0 == options.maxInstructions && 0 == options.maxMillis) {
+      std::cerr << "Error: Headless mode needs --instructions or --millis."
+                << std::endl;
+      return 1;
+    }
+    return run_headless(args[0], options, profiler.get(), tracer.get(),
+                        debugger.get(), telemetry.get());
+  }
+
   std::string keymap;
-  if (3 == argc) {
-    keymap = argv[2];
+  if (2 == args.size()) {
+    keymap = args[1];
   } else {
     keymap = DEFAULT_KEYMAP_FILENAME;
   }
   
   EmuVideoMemory vidMem;
-  EmuWindow window(&vidMem, keymap);
-  EmuProcessor processor(&window, argv[1]);
-  if (window.hasError() || processor.hasError()) {
+  EmuWindow window(&vidMem, keymap, options.presentMode);
+  window.setRefreshRate(options.refreshRate);
+  EmuProcessor processor(&window, args[0]);
+  if (window.hasError() || processor.hasError() ||
+      !start_processor(&processor, options, profiler.get(),
+                       tracer.get(), debugger.get(), telemetry.get())) {
     return 1;
   }
+  if (telemetry) {
+    window.setTelemetry(telemetry.get(), options.statsOverlay);
+  }
+  std::unique_ptr<EmuRecorder> recorder;
+  if (!options.recordFile.empty()) {
+    recorder.reset(new EmuRecorder(options.recordFile, options.refreshRate));
+    if (recorder->hasError()) {
+      return 1;
+    }
+    window.setRecorder(recorder.get());
+  }
+  std::unique_ptr<EmuRewind> rewind;
+  if (0 < options.rewindMegabytes) {
+    rewind.reset(new EmuRewind(options.rewindMegabytes << 20));
+    processor.setRewind(rewind.get());
+    window.setRewind(rewind.get());
+  }
 
   // Start up separate threads for the UI and processor
   std::thread winThread(win_thread_start, &window);
@@ -50,6 +443,22 @@ int main(int argc, char **argv) {
   winThread.join();
   processor.setRunning(false);
   procThread.join();
-  
-  return 0;
+
+  std::cout << "Rate: " << processor.getAchievedRate() << " MHz"
+            << std::endl
+            << "Idle: slept " << processor.getParkCount() << " times for "
+            << processor.getParkedMillis() << " ms" << std::endl;
+  window.reportPresentTiming(std::cout);
+  int status = finish_processor(&processor, options, profiler.get(),
+                                tracer.get(), telemetry.get());
+  if (recorder) {
+    if (!recorder->stop()) {
+      status = 1;
+    }
+    recorder->report(std::cout);
+  }
+  if (rewind) {
+    rewind->report(std::cout);
+  }
+  return status;
 }
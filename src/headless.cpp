@@ -0,0 +1,111 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include "headless.h"
+#include "pacer.h"
+
+EmuHeadless::EmuHeadless(EmuVideoMemory *vid_mem)
+                        : _vidMem(vid_mem),
+                          _nextInputEvent(0),
+                          _achievedMhz(0) { }
+
+bool EmuHeadless::loadInputScript(const std::string& script_filename) {
+  std::ifstream scriptFile(script_filename);
+  if (!scriptFile.good()) {
+    std::cerr << "Error: Failed to open input script '"
+              << script_filename << "'." << std::endl;
+    return false;
+  }
+  // Input script should be in the form
+  // INSTRUCTION INPUT_ID VALUE
+  // where INSTRUCTION is the number of instructions executed before
+  // the input takes on the new value.
+  std::string line;
+  while (std::getline(scriptFile, line)) {
+    std::istringstream iss(line);
+    InputEvent event;
+    if (!(iss >> event.instruction >> event.inputId >> event.value)) {
+      continue;
+    }
+    _inputEvents.push_back(event);
+  }
+  std::stable_sort(_inputEvents.begin(), _inputEvents.end(),
+                   [](const InputEvent& a, const InputEvent& b) {
+                     return a.instruction < b.instruction;
+                   });
+  _nextInputEvent = 0;
+  return true;
+}
+
+void EmuHeadless::_applyInputEvents(const uint64_t& instruction_count) {
+  while (_nextInputEvent < _inputEvents.size() &&
+         _inputEvents[_nextInputEvent].instruction <= instruction_count) {
+    const InputEvent& event = _inputEvents[_nextInputEvent];
+    _inputs.set(event.inputId, event.value);
+    _nextInputEvent++;
+  }
+}
+
+uint64_t EmuHeadless::run(EmuProcessor *processor,
+                          const uint64_t& max_instructions,
+                          const uint64_t& max_millis) {
+  // A limit of zero means no limit
+  auto start = std::chrono::steady_clock::now();
+  EmuPacer pacer(processor->getTargetRate(),
+                 processor->getInstructionCount());
+  uint64_t executed = 0;
+  while (processor->isRunning() &&
+         (0 == max_instructions || executed < max_instructions)) {
+    uint64_t count = processor->getInstructionCount();
+    _applyInputEvents(count);
+    // Run until the next input event, the instruction limit, or the
+    // end of the slice, whichever comes first
+    uint64_t slice = pacer.getSliceSize();
+    if (0 != max_instructions && max_instructions - executed < slice) {
+      slice = max_instructions - executed;
+    }
+    if (_nextInputEvent < _inputEvents.size() &&
+        _inputEvents[_nextInputEvent].instruction - count < slice) {
+      slice = _inputEvents[_nextInputEvent].instruction - count;
+    }
+    executed += processor->run(slice);
+    pacer.pace(processor->getInstructionCount());
+    if (0 != max_millis) {
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      if (std::chrono::duration_cast<std::chrono::milliseconds>(elapsed)
+          .count() >= (int64_t)max_millis) {
+        break;
+      }
+    }
+  }
+  _achievedMhz = pacer.getAchievedMhz(processor->getInstructionCount());
+  return executed;
+}
+
+bool EmuHeadless::dumpFrame(const std::string& dump_filename) {
+  // Write the frame as a binary PPM image
+  std::ofstream dumpFile(dump_filename, std::ofstream::binary);
+  if (!dumpFile.good()) {
+    std::cerr << "Error: Failed to open dump file '"
+              << dump_filename << "'." << std::endl;
+    return false;
+  }
+  dumpFile << "P6\n" << VIDEO_WIDTH << " " << VIDEO_HEIGHT << "\n255\n";
+  const uint8_t *data = _vidMem->getData();
+  std::vector<char> pixels(VIDEO_MEMORY_SIZE * 3);
+  for (int i = 0; i < VIDEO_MEMORY_SIZE; i++) {
+    uint32_t rgb = EmuVideoMemory::toRGB(data[i]);
+    pixels[(i * 3) + 0] = (rgb >> 16) & 0xff;
+    pixels[(i * 3) + 1] = (rgb >> 8) & 0xff;
+    pixels[(i * 3) + 2] = rgb & 0xff;
+  }
+  dumpFile.write(pixels.data(), pixels.size());
+  return dumpFile.good();
+}
@@ -0,0 +1,56 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#ifndef EMU_HEADLESS_H
+#define EMU_HEADLESS_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "io.h"
+#include "input.h"
+#include "vidmem.h"
+#include "processor.h"
+#include "defs.h"
+
+// A display and input backend that needs no X server. Input comes
+// from a script of timed events instead of the keyboard, and the
+// final contents of video memory can be dumped to a file.
+class EmuHeadless : public EmuIO {
+ public:
+  EmuHeadless(EmuVideoMemory *vid_mem);
+  EmuVideoMemory *getVideoMemory() { return _vidMem; }
+  uint16_t getInput(const uint16_t& input_id) {
+    return _inputs.get(input_id);
+  }
+  uint32_t getInputGeneration() { return _inputs.getGeneration(); }
+  void waitForInput(const uint32_t& generation,
+                    const std::chrono::steady_clock::time_point& deadline) {
+    _inputs.waitForChange(generation, deadline);
+  }
+  bool loadInputScript(const std::string& script_filename);
+  uint64_t run(EmuProcessor *processor,
+               const uint64_t& max_instructions,
+               const uint64_t& max_millis);
+  bool dumpFrame(const std::string& dump_filename);
+  double getAchievedRate() { return _achievedMhz; }
+
+ private:
+  struct InputEvent {
+    uint64_t instruction;
+    uint16_t inputId;
+    uint16_t value;
+  };
+  void _applyInputEvents(const uint64_t& instruction_count);
+
+  EmuVideoMemory *_vidMem;
+  EmuInputTable _inputs;
+  // Input events sorted by the instruction count they fire at
+  std::vector<InputEvent> _inputEvents;
+  size_t _nextInputEvent;
+  double _achievedMhz;
+};
+
+#endif
@@ -0,0 +1,58 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#ifndef EMU_INPUT_H
+#define EMU_INPUT_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include "defs.h"
+
+// The state of every input ID, written by whichever thread handles
+// input events and read by the processor thread. Unmapped inputs
+// read as 0. Each input is independent, so relaxed loads and stores
+// are all that is needed to read and write them. Changes are also
+// counted, so that the processor can sleep until one happens.
+class EmuInputTable {
+ public:
+  EmuInputTable() : _generation(0) {
+    for (int i = 0; i < NUM_INPUT_IDS; i++) {
+      _state[i].store(0, std::memory_order_relaxed);
+    }
+  }
+  uint16_t get(const uint16_t& input_id) {
+    return _state[input_id].load(std::memory_order_relaxed);
+  }
+  void set(const uint16_t& input_id, const uint16_t& value) {
+    if (value != _state[input_id].exchange(value, std::memory_order_relaxed)) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _generation.fetch_add(1, std::memory_order_release);
+      _changed.notify_all();
+    }
+  }
+  uint32_t getGeneration() {
+    return _generation.load(std::memory_order_acquire);
+  }
+  // Waits until an input has changed since the given generation, or
+  // until the deadline
+  void waitForChange(const uint32_t& generation,
+                     const std::chrono::steady_clock::time_point& deadline) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _changed.wait_until(lock, deadline, [&] {
+      return generation != _generation.load(std::memory_order_relaxed);
+    });
+  }
+
+ private:
+  std::atomic<uint16_t> _state[NUM_INPUT_IDS];
+  std::atomic<uint32_t> _generation;
+  std::mutex _mutex;
+  std::condition_variable _changed;
+};
+
+#endif
@@ -0,0 +1,29 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#ifndef EMU_IO_H
+#define EMU_IO_H
+
+#include <stdint.h>
+#include <chrono>
+#include "vidmem.h"
+
+// The display and input devices seen by the processor. The window
+// implements this for interactive use, and the headless backend
+// implements it for batch runs without an X server.
+class EmuIO {
+ public:
+  virtual ~EmuIO() {}
+  virtual EmuVideoMemory *getVideoMemory() = 0;
+  virtual uint16_t getInput(const uint16_t& input_id) = 0;
+  // A count of input changes, and a wait for it to move on from the
+  // given value that gives up at the deadline
+  virtual uint32_t getInputGeneration() = 0;
+  virtual void waitForInput(
+    const uint32_t& generation,
+    const std::chrono::steady_clock::time_point& deadline) = 0;
+};
+
+#endif
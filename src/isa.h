@@ -0,0 +1,153 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#ifndef EMU_ISA_H
+#define EMU_ISA_H
+
+#include <stdint.h>
+#include "defs.h"
+
+// How the three bytes after the opcode of an instruction are used
+enum EmuOperands {
+  OPERANDS_NONE,
+  // A register in the low bits of the first byte
+  OPERANDS_REG,
+  // A destination register in the first byte and a source register
+  // in the second
+  OPERANDS_REG_REG,
+  // A register in the first byte and a value in the last two
+  OPERANDS_REG_IMM,
+  // An address in the first two bytes
+  OPERANDS_ADDR,
+  // A count in the first byte
+  OPERANDS_COUNT
+};
+
+// How the overflow flag is worked out from an instruction that sets
+// the flags
+enum EmuOverflowRule {
+  // Never set
+  OVERFLOW_NONE,
+  // Set if two numbers of the same sign added up to the other sign
+  OVERFLOW_ADD,
+  // Set if numbers of different signs were subtracted and the sign of
+  // the result differs from the destination
+  OVERFLOW_SUB
+};
+
+// Which register an instruction writes, for the values that aren't a
+// fixed register
+#define ISA_WRITES_NONE 0xff
+#define ISA_WRITES_REG1 0x10
+
+// What every opcode does, as far as anything outside its own handler
+// needs to know
+struct EmuOpcodeInfo {
+  const char *mnemonic;
+  EmuOperands operands;
+  // Whether the instruction sets the flags from a result, rather than
+  // clearing them, and how it works out overflow
+  bool setsFlags;
+  EmuOverflowRule overflow;
+  // The register written, or one of the ISA_WRITES_* values
+  uint8_t writes;
+};
+
+// Indexed by opcode. Opcodes that don't exist run as NOP.
+constexpr EmuOpcodeInfo EMU_ISA[OPCODE_JNS + 1] = {
+  { "NOP",     OPERANDS_NONE,    false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "INPUT",   OPERANDS_REG_REG, false, OVERFLOW_NONE, ISA_WRITES_REG1 },
+  { "CALL",    OPERANDS_ADDR,    false, OVERFLOW_NONE, REG_SP },
+  { "RET",     OPERANDS_COUNT,   false, OVERFLOW_NONE, REG_SP },
+  { "LOAD",    OPERANDS_REG_REG, false, OVERFLOW_NONE, ISA_WRITES_REG1 },
+  { "LOADI",   OPERANDS_REG_IMM, false, OVERFLOW_NONE, ISA_WRITES_REG1 },
+  { "MOV",     OPERANDS_REG_REG, false, OVERFLOW_NONE, ISA_WRITES_REG1 },
+  { "MOVI",    OPERANDS_REG_IMM, false, OVERFLOW_NONE, ISA_WRITES_REG1 },
+  { "PUSH",    OPERANDS_REG,     false, OVERFLOW_NONE, REG_SP },
+  { "POP",     OPERANDS_REG,     false, OVERFLOW_NONE, ISA_WRITES_REG1 },
+  { "ADD",     OPERANDS_REG_REG, true,  OVERFLOW_ADD,  ISA_WRITES_REG1 },
+  { "SUB",     OPERANDS_REG_REG, true,  OVERFLOW_SUB,  ISA_WRITES_REG1 },
+  { "MUL",     OPERANDS_REG_REG, true,  OVERFLOW_NONE, ISA_WRITES_REG1 },
+  { "DIV",     OPERANDS_REG_REG, true,  OVERFLOW_NONE, ISA_WRITES_REG1 },
+  { "AND",     OPERANDS_REG_REG, true,  OVERFLOW_NONE, ISA_WRITES_REG1 },
+  { "OR",      OPERANDS_REG_REG, true,  OVERFLOW_NONE, ISA_WRITES_REG1 },
+  { "XOR",     OPERANDS_REG_REG, true,  OVERFLOW_NONE, ISA_WRITES_REG1 },
+  { "SHL",     OPERANDS_REG_REG, true,  OVERFLOW_NONE, ISA_WRITES_REG1 },
+  { "SHRA",    OPERANDS_REG_REG, true,  OVERFLOW_NONE, ISA_WRITES_REG1 },
+  { "SHRL",    OPERANDS_REG_REG, true,  OVERFLOW_NONE, ISA_WRITES_REG1 },
+  { "CMP",     OPERANDS_REG_REG, true,  OVERFLOW_SUB,  ISA_WRITES_NONE },
+  { "TST",     OPERANDS_REG_REG, true,  OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "COLOR",   OPERANDS_REG,     false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "PIXEL",   OPERANDS_REG_REG, false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "STOR",    OPERANDS_REG_REG, false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "STORI",   OPERANDS_REG_IMM, false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "TIME",    OPERANDS_REG,     false, OVERFLOW_NONE, ISA_WRITES_REG1 },
+  { "TIMERST", OPERANDS_NONE,    false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "RND",     OPERANDS_REG,     false, OVERFLOW_NONE, ISA_WRITES_REG1 },
+#define EMU_ISA_NONE \
+  { "???",     OPERANDS_NONE,    false, OVERFLOW_NONE, ISA_WRITES_NONE }
+  EMU_ISA_NONE, EMU_ISA_NONE, EMU_ISA_NONE, EMU_ISA_NONE,
+  EMU_ISA_NONE, EMU_ISA_NONE, EMU_ISA_NONE, EMU_ISA_NONE,
+  EMU_ISA_NONE, EMU_ISA_NONE, EMU_ISA_NONE, EMU_ISA_NONE,
+  EMU_ISA_NONE, EMU_ISA_NONE, EMU_ISA_NONE, EMU_ISA_NONE,
+  EMU_ISA_NONE, EMU_ISA_NONE, EMU_ISA_NONE,
+#undef EMU_ISA_NONE
+  { "JMP",     OPERANDS_REG,     false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "JMPI",    OPERANDS_ADDR,    false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "JEQ",     OPERANDS_ADDR,    false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "JNE",     OPERANDS_ADDR,    false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "JG",      OPERANDS_ADDR,    false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "JGE",     OPERANDS_ADDR,    false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "JA",      OPERANDS_ADDR,    false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "JAE",     OPERANDS_ADDR,    false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "JL",      OPERANDS_ADDR,    false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "JLE",     OPERANDS_ADDR,    false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "JB",      OPERANDS_ADDR,    false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "JBE",     OPERANDS_ADDR,    false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "JO",      OPERANDS_ADDR,    false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "JNO",     OPERANDS_ADDR,    false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "JS",      OPERANDS_ADDR,    false, OVERFLOW_NONE, ISA_WRITES_NONE },
+  { "JNS",     OPERANDS_ADDR,    false, OVERFLOW_NONE, ISA_WRITES_NONE }
+};
+
+// Register names, indexed by register
+constexpr const char *EMU_REGISTERS[NUM_REGISTERS] = {
+  "SP", "FP", "A", "B", "C", "D", "E", "F",
+  "G", "H", "I", "J", "K", "L", "M", "N"
+};
+
+// The 32-bit result that an instruction that sets the flags works
+// them out from. The opcode is a template argument so that each
+// handler only has its own operation compiled in.
+template <uint8_t Opcode>
+inline uint32_t emuResult(const uint32_t& dest, const uint32_t& src) {
+  static_assert(EMU_ISA[Opcode].setsFlags, "The opcode sets no flags");
+  switch (Opcode) {
+  case OPCODE_ADD:  return dest + src;
+  case OPCODE_SUB:
+  case OPCODE_CMP:  return dest - src;
+  case OPCODE_MUL:  return dest * src;
+  case OPCODE_DIV:  return dest / src;
+  case OPCODE_AND:
+  case OPCODE_TST:  return dest & src;
+  case OPCODE_OR:   return dest | src;
+  case OPCODE_XOR:  return dest ^ src;
+  case OPCODE_SHL:  return dest << src;
+  case OPCODE_SHRA: return (uint32_t)((int32_t)dest >> src);
+  case OPCODE_SHRL: return dest >> src;
+  default:          return 0;
+  }
+}
+
+// The value such an instruction writes to its destination, which is
+// the low half of the result, except that SHRA sign extends from 16
+// bits rather than 32
+template <uint8_t Opcode>
+inline uint16_t emuValue(const uint32_t& dest, const uint32_t& src) {
+  return OPCODE_SHRA == Opcode ? (uint16_t)((int16_t)dest >> src) :
+                                 (uint16_t)emuResult<Opcode>(dest, src);
+}
+
+#endif
@@ -0,0 +1,1313 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#include <sys/mman.h>
+#include <string.h>
+#include <iostream>
+#include "jit.h"
+#include "processor.h"
+
+// Size of the buffer that compiled blocks are written into. When it
+// fills up every block is thrown away and compilation starts over.
+#define JIT_CODE_SIZE (16 << 20)
+// Longest block, in instructions, and the most machine code that a
+// single instruction can compile to
+#define JIT_MAX_BLOCK 64
+#define JIT_MAX_INST_BYTES 256
+
+// x86-64 register numbers
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RSP 4
+#define RBP 5
+#define RSI 6
+#define RDI 7
+#define R8  8
+#define R9  9
+#define R10 10
+#define R11 11
+#define R12 12
+#define R13 13
+#define R14 14
+#define R15 15
+
+// Registers that hold pointers into the processor while a block runs.
+// Main memory, the decoded slots and the page flags are reached from
+// the guest registers with a displacement.
+#define REG_CTX RBX
+#define REG_REGS R12
+// The instructions retired since the host entered compiled code, which
+// goes back into the context on the way out
+#define REG_EXECUTED R15
+
+// Host registers that guest registers are kept in. SP lives in the
+// first from when the host enters compiled code until it returns, and
+// the rest are handed out to each block in order, except the second in
+// blocks that draw pixels. The ones after the callee-saved registers
+// are lost across calls to helpers.
+static const uint8_t CACHE_REGS[] = {
+  R13, R14, RBP, R8, R9, R10, R11
+};
+#define JIT_CALLEE_SAVED_CACHE 3
+
+// x86 condition codes, as the low nibble of a Jcc opcode
+#define CC_O  0x0
+#define CC_NO 0x1
+#define CC_B  0x2
+#define CC_AE 0x3
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_BE 0x6
+#define CC_A  0x7
+#define CC_S  0x8
+#define CC_NS 0x9
+#define CC_L  0xC
+#define CC_GE 0xD
+#define CC_LE 0xE
+#define CC_G  0xF
+#define CC_ALWAYS 0x10
+
+static_assert(8 == sizeof(EmuDecodedInst),
+              "Compiled stores index decoded slots with a scale of 8");
+
+// Instructions that blocks never contain and leave to the interpreter.
+// TIME and TIMERST read the instruction count, which is only brought
+// up to date when a block is left.
+static bool isHostInst(const uint8_t& opcode) {
+  return OPCODE_TIME == opcode || OPCODE_TIMERST == opcode;
+}
+
+// The x86 condition that matches a Consolite conditional jump when
+// the x86 flags were set by the same operation
+static uint8_t jumpCondition(const uint8_t& opcode) {
+  switch (opcode) {
+  case OPCODE_JEQ: return CC_E;
+  case OPCODE_JNE: return CC_NE;
+  case OPCODE_JG:  return CC_G;
+  case OPCODE_JGE: return CC_GE;
+  case OPCODE_JA:  return CC_A;
+  case OPCODE_JAE: return CC_AE;
+  case OPCODE_JL:  return CC_L;
+  case OPCODE_JLE: return CC_LE;
+  case OPCODE_JB:  return CC_B;
+  case OPCODE_JBE: return CC_BE;
+  case OPCODE_JO:  return CC_O;
+  case OPCODE_JNO: return CC_NO;
+  case OPCODE_JS:  return CC_S;
+  case OPCODE_JNS: return CC_NS;
+  default:         return CC_ALWAYS;
+  }
+}
+
+static uint8_t normalizeOpcode(const uint8_t& opcode) {
+  if ((OPCODE_RND < opcode && opcode < OPCODE_JMP) || OPCODE_JNS < opcode) {
+    return OPCODE_NOP;
+  }
+  return opcode;
+}
+
+// Whether the instruction writes its first register without reading it
+static bool replacesReg1(const uint8_t& opcode) {
+  return OPCODE_INPUT == opcode || OPCODE_LOAD == opcode ||
+    OPCODE_LOADI == opcode || OPCODE_MOV == opcode ||
+    OPCODE_MOVI == opcode || OPCODE_POP == opcode || OPCODE_RND == opcode;
+}
+
+// Whether the instruction is the last one in its block
+static bool endsBlock(const uint8_t& opcode) {
+  return OPCODE_CALL == opcode || OPCODE_RET == opcode ||
+    OPCODE_JMP <= opcode;
+}
+
+EmuJit::EmuJit(EmuProcessor *processor)
+              : _processor(processor),
+                _liveFlags(OPCODE_NOP),
+                _hostFlags(false),
+                _cached(0),
+                _dirty(0),
+                _error(false) {
+  memset(_blocks, 0, sizeof(_blocks));
+  const uint8_t *regs = (const uint8_t *)processor->_registers;
+  _memDisp = (int32_t)(processor->_mainMem - regs);
+  _decodedDisp = (int32_t)((const uint8_t *)processor->_decoded - regs);
+  _pagesDisp = (int32_t)(processor->_pageFlags - regs);
+  _colorDisp = (int32_t)(&processor->_colorRegister - regs);
+  // The buffer is never writable and executable at the same time. It
+  // is only made writable while blocks are being written into it.
+  void *code = mmap(nullptr, JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (MAP_FAILED == code) {
+    std::cerr << "Error: Cannot allocate memory for compiled code."
+              << std::endl;
+    _code = _cursor = nullptr;
+    _error = true;
+    return;
+  }
+  _code = _cursor = (uint8_t *)code;
+  _emitDispatcher();
+  _setWritable(false);
+}
+
+EmuJit::~EmuJit() {
+  if (nullptr != _code) {
+    munmap(_code, JIT_CODE_SIZE);
+  }
+}
+
+// Called from compiled code, so the arguments are passed by value
+int EmuJit::_condition(EmuProcessor *processor, int opcode) {
+  return processor->_condition(opcode) ? 1 : 0;
+}
+
+int EmuJit::_input(EmuProcessor *processor, int input_id) {
+  return processor->_io->getInput(input_id);
+}
+
+int EmuJit::_random(EmuProcessor *processor) {
+  return processor->_random();
+}
+
+void EmuJit::_setWritable(const bool& writable) {
+  mprotect(_code, JIT_CODE_SIZE,
+           PROT_READ | (writable ? PROT_WRITE : PROT_EXEC));
+}
+
+void EmuJit::flush() {
+  memset(_blocks, 0, sizeof(_blocks));
+  for (int page = 0; page < MAIN_MEMORY_SIZE / MEMORY_PAGE_SIZE; page++) {
+    _pageBlocks[page].clear();
+    _processor->_pageFlags[page] &= ~PAGE_FLAG_JIT;
+  }
+  for (int slot = 0; slot < MAIN_MEMORY_SIZE / INST_SIZE; slot++) {
+    _incoming[slot].clear();
+  }
+  _cursor = _code;
+  _setWritable(true);
+  _emitDispatcher();
+  _setWritable(false);
+}
+
+void EmuJit::invalidate(const uint16_t& addr) {
+  uint16_t page = addr / MEMORY_PAGE_SIZE;
+  uint16_t slot = addr / INST_SIZE;
+  std::vector<uint16_t>& starts = _pageBlocks[page];
+  size_t kept = 0;
+  bool writable = false;
+  for (size_t i = 0; i < starts.size(); i++) {
+    EmuJitBlock& block = _blocks[starts[i]];
+    if (!block.compiled) {
+      // Already thrown away through another page
+      continue;
+    }
+    uint16_t length = 0 == block.length ? 1 : block.length;
+    uint16_t offset = (slot - starts[i]) & (MAIN_MEMORY_SIZE / INST_SIZE - 1);
+    if (offset < length) {
+      // Jumps to the block go back through the dispatcher, which sends
+      // them to the host to compile it again
+      if (block.chainable) {
+        if (!writable && !_incoming[starts[i]].empty()) {
+          _setWritable(true);
+          writable = true;
+        }
+        for (uint8_t *rel : _incoming[starts[i]]) {
+          _point(rel, _dispatcher);
+        }
+        _entries[starts[i]] = _hostReturn;
+      }
+      block.compiled = false;
+      block.chainable = false;
+      continue;
+    }
+    starts[kept++] = starts[i];
+  }
+  if (writable) {
+    _setWritable(false);
+  }
+  starts.resize(kept);
+  if (starts.empty()) {
+    _processor->_pageFlags[page] &= ~PAGE_FLAG_JIT;
+  }
+}
+
+void EmuJit::_registerBlock(const uint16_t& slot, const uint16_t& length) {
+  uint16_t covered = 0 == length ? 1 : length;
+  int lastPage = -1;
+  for (uint16_t i = 0; i < covered; i++) {
+    uint16_t addr = ((slot + i) * INST_SIZE) & 0xffff;
+    // An instruction never straddles a page boundary
+    int page = addr / MEMORY_PAGE_SIZE;
+    if (page != lastPage) {
+      _pageBlocks[page].push_back(slot);
+      _processor->_pageFlags[page] |= PAGE_FLAG_JIT;
+      lastPage = page;
+    }
+  }
+}
+
+uint64_t EmuJit::run(const uint64_t& max_instructions) {
+  EmuProcessor *p = _processor;
+  EmuJitContext ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  uint64_t remaining = max_instructions;
+  while (0 != remaining) {
+    uint16_t slot = p->_instructionPointer / INST_SIZE;
+    const EmuJitBlock *block = &_blocks[slot];
+    if (!block->compiled) {
+      block = &_compile(slot);
+    }
+    if (0 == block->length) {
+      // Leave this instruction to the interpreter
+      remaining -= p->_runThreaded<false>(1);
+      continue;
+    } else if (remaining < block->length) {
+      // Not enough of the budget is left for the whole block
+      remaining -= p->_runThreaded<false>(remaining);
+      continue;
+    }
+    ctx.executed = 0;
+    ctx.budget = remaining;
+    ctx.storeExit = 0;
+    p->_instructionPointer = block->fn(&ctx);
+    p->_instructionCount += ctx.executed;
+    remaining -= ctx.executed;
+    if (OPCODE_NOP == ctx.flagOpcode) {
+      p->_clearFlags();
+    } else {
+      p->_setFlags(ctx.flagDest, ctx.flagSrc, ctx.flagResult,
+                   ctx.flagOpcode);
+    }
+    if (ctx.storeExit) {
+      // The block wrote to a page that somebody is watching, which
+      // may include compiled code
+      p->_storeHook(ctx.storeAddr);
+    }
+  }
+  return max_instructions - remaining;
+}
+
+const EmuJitBlock& EmuJit::_compile(const uint16_t& slot) {
+  EmuJitBlock& block = _blocks[slot];
+  const uint8_t *mem = _processor->_mainMem;
+  uint8_t first = normalizeOpcode(mem[slot * INST_SIZE]);
+  if (isHostInst(first)) {
+    block.fn = nullptr;
+    block.length = 0;
+    block.compiled = true;
+    block.chainable = false;
+    _registerBlock(slot, 0);
+    return block;
+  }
+  if (_cursor + ((JIT_MAX_BLOCK + 2) * JIT_MAX_INST_BYTES) >
+      _code + JIT_CODE_SIZE) {
+    flush();
+  }
+
+  _setWritable(true);
+  uint8_t *start = _cursor;
+  // Prologue: save the callee-saved registers, leave the stack 16-byte
+  // aligned for calls to helpers, and load the pointers into the
+  // processor. Chained blocks skip this.
+  const uint8_t grp1[] = { 0x81 };
+  _byte(0x53);                             // push rbx
+  _byte(0x55);                             // push rbp
+  _byte(0x41); _byte(0x54);                // push r12
+  _byte(0x41); _byte(0x55);                // push r13
+  _byte(0x41); _byte(0x56);                // push r14
+  _byte(0x41); _byte(0x57);                // push r15
+  _opReg(0, true, grp1, 1, 5, RSP); _dword(8); // sub rsp, 8
+  const uint8_t movRR[] = { 0x89 };
+  const uint8_t xorRR[] = { 0x31 };
+  _opReg(0, true, movRR, 1, RDI, REG_CTX); // mov rbx, rdi
+  _movImm64(REG_REGS, (uint64_t)_processor->_registers);
+  _opReg(0, false, xorRR, 1, REG_EXECUTED, REG_EXECUTED); // xor r15d, r15d
+  const uint8_t movzx16[] = { 0x0f, 0xb7 };
+  _opMem(0, false, movzx16, 2, CACHE_REGS[0], REG_REGS, -1, 0,
+         REG_SP * 2);                      // movzx r13d, SP
+  _blockSlot = slot;
+  _blockBody = _cursor;
+  _blockChainable = first < OPCODE_JEQ;
+  // Go back to the host if the block doesn't fit in the budget. The
+  // length goes in once the block is done.
+  _blockLength = _checkBudget(0);
+  uint8_t *fits = _jump(CC_BE);
+  _movImm32(RAX, slot * INST_SIZE);
+  _jumpTo(_hostReturn);
+  _patch(fits);
+  _cacheRegs(slot);
+  _blockLoaded = _cursor;
+
+  _liveFlags = OPCODE_NOP;
+  _hostFlags = false;
+  uint16_t length = 0;
+  bool terminated = false;
+  while (length < JIT_MAX_BLOCK) {
+    uint16_t current = (slot + length) & (MAIN_MEMORY_SIZE / INST_SIZE - 1);
+    if (isHostInst(normalizeOpcode(mem[current * INST_SIZE]))) {
+      break;
+    }
+    terminated = _compileInst(current, length);
+    length++;
+    if (terminated) {
+      break;
+    }
+  }
+  if (!terminated) {
+    // Fall through to the next instruction
+    _jumpToBlock(((slot + length) * INST_SIZE) & 0xffff, length, true);
+  }
+  uint32_t length32 = length;
+  memcpy(_blockLength, &length32, sizeof(length32));
+
+  block.fn = (EmuJitBlockFn)start;
+  block.length = length;
+  block.compiled = true;
+  // A block that starts with a conditional jump reads the flags from
+  // the processor, which are only up to date when entered from the host
+  block.chainable = _blockChainable;
+  if (block.chainable) {
+    _entries[slot] = _blockBody;
+    for (uint8_t *rel : _incoming[slot]) {
+      _point(rel, _blockBody);
+    }
+  }
+  _setWritable(false);
+  _registerBlock(slot, length);
+  return block;
+}
+
+void EmuJit::_emitDispatcher() {
+  // Entered with the next instruction address in eax, and jumps to the
+  // entry for it. Every entry starts out going back to the host.
+  const uint8_t grp1[] = { 0x81 };
+  const uint8_t movM64[] = { 0x89 };
+  _hostReturn = _cursor;
+  _opMem(0, true, movM64, 1, REG_EXECUTED, REG_CTX, -1, 0,
+         offsetof(EmuJitContext, executed));             // mov executed, r15
+  _opMem(0x66, false, movM64, 1, CACHE_REGS[0], REG_REGS, -1, 0,
+         REG_SP * 2);                                    // mov SP, r13w
+  _opReg(0, true, grp1, 1, 0, RSP); _dword(8);           // add rsp, 8
+  _byte(0x41); _byte(0x5f);                              // pop r15
+  _byte(0x41); _byte(0x5e);                              // pop r14
+  _byte(0x41); _byte(0x5d);                              // pop r13
+  _byte(0x41); _byte(0x5c);                              // pop r12
+  _byte(0x5d);                                           // pop rbp
+  _byte(0x5b);                                           // pop rbx
+  _byte(0xc3);                                           // ret
+  _dispatcher = _cursor;
+  _jumpToEntry();
+  for (int slot = 0; slot < MAIN_MEMORY_SIZE / INST_SIZE; slot++) {
+    _entries[slot] = _hostReturn;
+  }
+}
+
+bool EmuJit::_compileInst(const uint16_t& slot, const uint16_t& index) {
+  const uint8_t *inst = &_processor->_mainMem[slot * INST_SIZE];
+  uint8_t opcode = normalizeOpcode(inst[0]);
+  uint8_t reg1 = inst[1] & 0xf;
+  uint8_t reg2 = inst[2] & 0xf;
+  uint16_t argA = ((inst[1] << 8) | inst[2]) & 0xfffc;
+  uint16_t argB = (inst[2] << 8) | inst[3];
+  uint16_t ip = slot * INST_SIZE;
+  uint16_t nextIp = ip + INST_SIZE;
+  uint16_t executed = index + 1;
+
+  const uint8_t movRR[] = { 0x89 };
+  const uint8_t lea[] = { 0x8d };
+  const uint8_t addRR[] = { 0x01 };
+  const uint8_t subRR[] = { 0x29 };
+  const uint8_t andRR[] = { 0x21 };
+  const uint8_t orRR[] = { 0x09 };
+  const uint8_t xorRR[] = { 0x31 };
+  const uint8_t cmpRR[] = { 0x39 };
+  const uint8_t testRR[] = { 0x85 };
+  const uint8_t imulRR[] = { 0x0f, 0xaf };
+  const uint8_t movsx16[] = { 0x0f, 0xbf };
+  const uint8_t movzx16[] = { 0x0f, 0xb7 };
+  const uint8_t shiftCl[] = { 0xd3 };
+  const uint8_t grp3[] = { 0xf7 };
+  const uint8_t grp1[] = { 0x81 };
+  const uint8_t movM8[] = { 0x88 };
+
+  // Flags from the previous instruction are only ever read by the
+  // instruction right after it. That is a conditional jump in this
+  // block, or the host if the block ends here.
+  uint8_t liveFlags = _liveFlags;
+  bool hostFlags = _hostFlags;
+  _liveFlags = OPCODE_NOP;
+  _hostFlags = false;
+  uint8_t next = index + 1 < JIT_MAX_BLOCK ?
+    normalizeOpcode(_processor->_mainMem[nextIp]) : OPCODE_TIME;
+  bool flagsToJump = OPCODE_JEQ <= next;
+  bool flagsToHost = isHostInst(next);
+
+  switch (opcode) {
+  case OPCODE_NOP:
+  default:
+    return false;
+  case OPCODE_CALL:
+    // SP += 2, then store the return address at SP
+    _loadReg(RAX, REG_SP);
+    _opReg(0, false, grp1, 1, 0, RAX); _dword(2);       // add eax, 2
+    _opReg(0, false, movzx16, 2, RAX, RAX);             // movzx eax, ax
+    _storeReg(REG_SP, RAX);
+    _movImm32(RCX, ip);
+    _storeMem(argA, executed);
+    _jumpToBlock(argA, executed, false);
+    return true;
+  case OPCODE_RET:
+    // Pop the return address, then drop the extra bytes
+    _loadReg(RAX, REG_SP);
+    _loadMem();
+    _opReg(0, false, grp1, 1, 5, RAX); _dword(2 + inst[1]); // sub eax, n
+    _storeReg(REG_SP, RAX);
+    _opMem(0, false, lea, 1, RAX, RCX, -1, 0, INST_SIZE); // lea eax, [rcx+4]
+    _opReg(0, false, grp1, 1, 4, RAX); _dword(0xfffc);  // and eax, 0xfffc
+    _exit(executed, false);
+    _jumpToEntry();
+    return true;
+  case OPCODE_LOAD:
+    _loadReg(RAX, reg2);
+    _loadMem();
+    _storeReg(reg1, RCX);
+    return false;
+  case OPCODE_LOADI:
+    _loadMemConst(argB);
+    _storeReg(reg1, RCX);
+    return false;
+  case OPCODE_MOV:
+    if (_cached & (1 << reg1)) {
+      _loadReg(CACHE_REGS[_cacheIndex[reg1]], reg2);
+      _dirty |= 1 << reg1;
+      return false;
+    }
+    _loadReg(RAX, reg2);
+    _storeReg(reg1, RAX);
+    return false;
+  case OPCODE_MOVI:
+    _storeRegImm(reg1, argB);
+    return false;
+  case OPCODE_PUSH:
+    _loadReg(RCX, reg1);
+    _loadReg(RAX, REG_SP);
+    _opReg(0, false, grp1, 1, 0, RAX); _dword(2);       // add eax, 2
+    _opReg(0, false, movzx16, 2, RAX, RAX);             // movzx eax, ax
+    _storeReg(REG_SP, RAX);
+    _storeMem(nextIp, executed);
+    return false;
+  case OPCODE_POP:
+    _loadReg(RAX, REG_SP);
+    _loadMem();
+    _opReg(0, false, grp1, 1, 5, RAX); _dword(2);       // sub eax, 2
+    _storeReg(REG_SP, RAX);
+    _storeReg(reg1, RCX);
+    return false;
+  case OPCODE_ADD:
+  case OPCODE_SUB:
+  case OPCODE_MUL:
+  case OPCODE_AND:
+  case OPCODE_OR:
+  case OPCODE_XOR:
+  case OPCODE_CMP:
+  case OPCODE_TST:
+    if (!flagsToHost && (OPCODE_MUL != opcode || !flagsToJump)) {
+      _aluInPlace(opcode, reg1, reg2);
+      if (flagsToJump) {
+        // The x86 flags from a 16-bit operation are the flags
+        _liveFlags = opcode;
+        _hostFlags = true;
+      }
+      return false;
+    }
+    // ecx = dest, edx = src, eax = 32-bit result
+    _loadReg(RCX, reg1);
+    _loadReg(RDX, reg2);
+    _opReg(0, false, movRR, 1, RCX, RAX);               // mov eax, ecx
+    switch (opcode) {
+    case OPCODE_ADD: _opReg(0, false, addRR, 1, RDX, RAX); break;
+    case OPCODE_SUB:
+    case OPCODE_CMP: _opReg(0, false, subRR, 1, RDX, RAX); break;
+    case OPCODE_MUL: _opReg(0, false, imulRR, 2, RAX, RDX); break;
+    case OPCODE_AND:
+    case OPCODE_TST: _opReg(0, false, andRR, 1, RDX, RAX); break;
+    case OPCODE_OR:  _opReg(0, false, orRR, 1, RDX, RAX); break;
+    case OPCODE_XOR: _opReg(0, false, xorRR, 1, RDX, RAX); break;
+    }
+    if (ISA_WRITES_REG1 == EMU_ISA[opcode].writes) {
+      _storeReg(reg1, RAX);
+    }
+    _liveFlags = opcode;
+    return false;
+  case OPCODE_DIV: {
+    _loadReg(RCX, reg1);
+    _loadReg(RDX, reg2);
+    _opReg(0, false, testRR, 1, RDX, RDX);              // test edx, edx
+    uint8_t *byZero = _jump(CC_E);
+    _opReg(0, false, movRR, 1, RDX, RSI);               // mov esi, edx
+    _opReg(0, false, movRR, 1, RCX, RAX);               // mov eax, ecx
+    _opReg(0, false, xorRR, 1, RDX, RDX);               // xor edx, edx
+    _opReg(0, false, grp3, 1, 6, RSI);                  // div esi
+    _opReg(0, false, movRR, 1, RSI, RDX);               // mov edx, esi
+    _storeReg(reg1, RAX);
+    uint8_t *done = _jump(CC_ALWAYS);
+    _patch(byZero);
+    // Dividing by zero sets the destination to all ones and clears
+    // the flags, which is what a result of 1 would do
+    _storeRegImm(reg1, 0xffff);
+    _movImm32(RAX, 1);
+    _patch(done);
+    _liveFlags = opcode;
+    return false;
+  }
+  case OPCODE_SHL:
+  case OPCODE_SHRA:
+  case OPCODE_SHRL:
+    if (!flagsToHost && !flagsToJump) {
+      _aluInPlace(opcode, reg1, reg2);
+      return false;
+    }
+    _loadReg(RCX, reg1);
+    _loadReg(RDX, reg2);
+    _opReg(0, false, movRR, 1, RCX, RSI);               // mov esi, ecx
+    _opReg(0, false, movRR, 1, RDX, RCX);               // mov ecx, edx
+    if (OPCODE_SHRA == opcode) {
+      // The register gets an arithmetic shift of the 16-bit value,
+      // but the flags come from the zero-extended value
+      _opReg(0, false, movsx16, 2, RAX, RSI);           // movsx eax, si
+      _opReg(0, false, shiftCl, 1, 7, RAX);             // sar eax, cl
+      _storeReg(reg1, RAX);
+      _opReg(0, false, movRR, 1, RSI, RAX);             // mov eax, esi
+      _opReg(0, false, shiftCl, 1, 5, RAX);             // shr eax, cl
+    } else {
+      _opReg(0, false, movRR, 1, RSI, RAX);             // mov eax, esi
+      _opReg(0, false, shiftCl, 1,
+             OPCODE_SHL == opcode ? 4 : 5, RAX);        // shl/shr eax, cl
+      _storeReg(reg1, RAX);
+    }
+    _opReg(0, false, movRR, 1, RSI, RCX);               // mov ecx, esi
+    _liveFlags = opcode;
+    return false;
+  case OPCODE_INPUT:
+    _movImm64(RDI, (uint64_t)_processor);
+    _loadReg(RSI, reg2);
+    _callHelper((const void *)&EmuJit::_input);
+    _storeReg(reg1, RAX);
+    return false;
+  case OPCODE_RND:
+    _movImm64(RDI, (uint64_t)_processor);
+    _callHelper((const void *)&EmuJit::_random);
+    _storeReg(reg1, RAX);
+    return false;
+  case OPCODE_PIXEL:
+    _drawPixel(reg1, reg2);
+    return false;
+  case OPCODE_COLOR:
+    _loadReg(RAX, reg1);
+    _opMem(0, false, movM8, 1, RAX, REG_REGS, -1, 0,
+           _colorDisp);                                 // mov color, al
+    return false;
+  case OPCODE_STOR:
+    _loadReg(RCX, reg1);
+    _loadReg(RAX, reg2);
+    _storeMem(nextIp, executed);
+    return false;
+  case OPCODE_STORI:
+    _loadReg(RCX, reg1);
+    _storeMemConst(argB, nextIp, executed);
+    return false;
+  case OPCODE_JMP:
+    _loadReg(RAX, reg1);
+    _opReg(0, false, grp1, 1, 4, RAX); _dword(0xfffc);  // and eax, 0xfffc
+    _exit(executed, false);
+    _jumpToEntry();
+    return true;
+  case OPCODE_JMPI:
+    _jumpToBlock(argA, executed, false);
+    return true;
+  case OPCODE_JEQ:
+  case OPCODE_JNE:
+  case OPCODE_JG:
+  case OPCODE_JGE:
+  case OPCODE_JA:
+  case OPCODE_JAE:
+  case OPCODE_JL:
+  case OPCODE_JLE:
+  case OPCODE_JB:
+  case OPCODE_JBE:
+  case OPCODE_JO:
+  case OPCODE_JNO:
+  case OPCODE_JS:
+  case OPCODE_JNS: {
+    uint8_t cond = jumpCondition(opcode);
+    bool carry = OPCODE_JA == opcode || OPCODE_JAE == opcode ||
+      OPCODE_JB == opcode || OPCODE_JBE == opcode;
+    if (hostFlags) {
+      // The flags are already in the x86 flags
+    } else if (OPCODE_NOP == liveFlags) {
+      if (0 == index) {
+        // The flags were set before the block was entered
+        _movImm64(RDI, (uint64_t)_processor);
+        _movImm32(RSI, opcode);
+        _callHelper((const void *)&EmuJit::_condition);
+        _opReg(0, false, testRR, 1, RAX, RAX);          // test eax, eax
+        cond = CC_NE;
+      } else {
+        // The previous instruction cleared the flags, and "test" with
+        // a nonzero positive value leaves x86 flags in the same state
+        _movImm32(RAX, 1);
+        _opReg(0, false, testRR, 1, RAX, RAX);          // test eax, eax
+      }
+    } else if (OVERFLOW_ADD == EMU_ISA[liveFlags].overflow) {
+      _opReg(0x66, false, addRR, 1, RDX, RCX);          // add cx, dx
+    } else if (OVERFLOW_SUB == EMU_ISA[liveFlags].overflow) {
+      _opReg(0x66, false, cmpRR, 1, RDX, RCX);          // cmp cx, dx
+    } else if ((OPCODE_MUL == liveFlags || OPCODE_SHL == liveFlags) &&
+               carry) {
+      // The carry flag is set if the 32-bit result doesn't fit in
+      // 16 bits, which an x86 16-bit operation won't tell us
+      if (OPCODE_JA == opcode || OPCODE_JBE == opcode) {
+        // Carry or zero is the same as result - 1 >= 0xffff
+        _opReg(0, false, grp1, 1, 5, RAX); _dword(1);   // sub eax, 1
+        _opReg(0, false, grp1, 1, 7, RAX); _dword(0xfffe);
+        cond = OPCODE_JA == opcode ? CC_BE : CC_A;
+      } else {
+        _opReg(0, false, grp1, 1, 7, RAX); _dword(0xffff);
+        cond = OPCODE_JB == opcode ? CC_A : CC_BE;
+      }
+    } else {
+      // Logical results never carry or overflow
+      _opReg(0x66, false, testRR, 1, RAX, RAX);         // test ax, ax
+    }
+    uint8_t *taken = _jump(cond);
+    _jumpToBlock(nextIp, executed, false);
+    _patch(taken);
+    _jumpToBlock(argA, executed, false);
+    return true;
+  }
+  }
+}
+
+void EmuJit::_aluInPlace(const uint8_t& opcode, const uint8_t& reg1,
+                         const uint8_t& reg2) {
+  // Works on the destination in place, in its host register if it is
+  // kept in one and in eax if it isn't, when nothing needs the operands
+  // for the flags afterwards. A 16-bit operation leaves the upper bits
+  // clear and the x86 flags as the Consolite flags. Clobbers eax, ecx
+  // and edx.
+  const uint8_t movzx16[] = { 0x0f, 0xb7 };
+  const uint8_t movsx16[] = { 0x0f, 0xbf };
+  const uint8_t imulRR[] = { 0x0f, 0xaf };
+  const uint8_t shiftCl[] = { 0xd3 };
+  bool cached = _cached & (1 << reg1);
+  bool shift = OPCODE_SHL == opcode || OPCODE_SHRA == opcode ||
+    OPCODE_SHRL == opcode;
+  int dest = cached ? CACHE_REGS[_cacheIndex[reg1]] : RAX;
+  int src = RDX;
+  if (shift) {
+    _loadReg(RCX, reg2);
+  } else if (_cached & (1 << reg2)) {
+    src = CACHE_REGS[_cacheIndex[reg2]];
+  } else {
+    _loadReg(RDX, reg2);
+  }
+  if (!cached) {
+    _loadReg(RAX, reg1);
+  }
+  if (shift) {
+    if (OPCODE_SHRA == opcode) {
+      _opReg(0, false, movsx16, 2, dest, dest);         // movsx dest, dest16
+    }
+    _opReg(0, false, shiftCl, 1,
+           OPCODE_SHL == opcode ? 4 : OPCODE_SHRA == opcode ? 7 : 5,
+           dest);                                       // shift dest, cl
+    if (OPCODE_SHRL != opcode) {
+      _opReg(0, false, movzx16, 2, dest, dest);         // movzx dest, dest16
+    }
+  } else if (OPCODE_MUL == opcode) {
+    _opReg(0, false, imulRR, 2, dest, src);             // imul dest, src
+    _opReg(0, false, movzx16, 2, dest, dest);           // movzx dest, dest16
+  } else {
+    uint8_t op[] = { 0 };
+    switch (opcode) {
+    case OPCODE_ADD: op[0] = 0x01; break;
+    case OPCODE_SUB: op[0] = 0x29; break;
+    case OPCODE_AND: op[0] = 0x21; break;
+    case OPCODE_OR:  op[0] = 0x09; break;
+    case OPCODE_XOR: op[0] = 0x31; break;
+    case OPCODE_CMP: op[0] = 0x39; break;
+    case OPCODE_TST: op[0] = 0x85; break;
+    }
+    _opReg(0x66, false, op, 1, src, dest);              // op dest16, src16
+  }
+  if (ISA_WRITES_REG1 != EMU_ISA[opcode].writes) {
+    return;
+  } else if (cached) {
+    _dirty |= 1 << reg1;
+  } else {
+    _storeReg(reg1, RAX);
+  }
+}
+
+void EmuJit::_drawPixel(const uint8_t& reg_x, const uint8_t& reg_y) {
+  // Does what EmuVideoMemory::set() does with the color register,
+  // without calling it, and counts the pixel in r14 until the block is
+  // left. Clobbers eax, ecx, edx and esi.
+  static_assert(256 == VIDEO_WIDTH, "Rows are indexed with a shift");
+  const uint8_t movzx8[] = { 0x0f, 0xb6 };
+  const uint8_t movM8[] = { 0x88 };
+  const uint8_t movM8Imm[] = { 0xc6 };
+  const uint8_t movRM[] = { 0x8b };
+  const uint8_t movM32[] = { 0x89 };
+  const uint8_t movRR[] = { 0x89 };
+  const uint8_t orRR[] = { 0x09 };
+  const uint8_t shiftImm[] = { 0xc1 };
+  const uint8_t grp1[] = { 0x81 };
+  EmuVideoMemory *vid = _processor->_vidMem;
+  const uint8_t *base = (const uint8_t *)vid;
+  _opReg(0, true, grp1, 1, 0, CACHE_REGS[1]); _dword(1); // add r14, 1
+  _movImm64(RCX, (uint64_t)vid);
+  _loadReg(RDX, reg_y);
+  _opReg(0, false, movzx8, 2, RDX, RDX);                 // movzx edx, dl
+  _opReg(0, false, grp1, 1, 7, RDX); _dword(VIDEO_HEIGHT); // cmp edx, height
+  uint8_t *offscreen = _jump(CC_AE);
+  _loadReg(RAX, reg_x);
+  _opReg(0, false, movzx8, 2, RAX, RAX);                 // movzx eax, al
+  _opReg(0, false, movRR, 1, RDX, RSI);                  // mov esi, edx
+  _opReg(0, false, shiftImm, 1, 4, RSI); _byte(8);       // shl esi, 8
+  _opReg(0, false, orRR, 1, RAX, RSI);                   // or esi, eax
+  _opMem(0, false, movzx8, 2, RAX, REG_REGS, -1, 0,
+         _colorDisp);                                    // movzx eax, color
+  _opMem(0, false, movM8, 1, RAX, RCX, RSI, 1,
+         vid->_data - base);                             // mov [data+rsi], al
+  _opMem(0, false, movRM, 1, RAX, RCX, -1, 0,
+         (const uint8_t *)&vid->_generation - base);     // mov eax, generation
+  _opMem(0, false, movM32, 1, RAX, RCX, RDX, 4,
+         (const uint8_t *)vid->_rowStamps - base);       // mov [rows+rdx*4], eax
+  _opMem(0, false, movM8Imm, 1, 0, RCX, -1, 0,
+         (const uint8_t *)&vid->_dirty - base);
+  _byte(1);                                              // mov [dirty], 1
+  _patch(offscreen);
+}
+
+void EmuJit::_callHelper(const void *fn) {
+  // The stack is 16-byte aligned all through a block. Guest registers
+  // in caller-saved registers go back to memory around the call, so
+  // the helper is free to clobber everything else.
+  uint16_t spilled = 0;
+  for (int reg = 0; reg < NUM_REGISTERS; reg++) {
+    if ((_cached & (1 << reg)) &&
+        JIT_CALLEE_SAVED_CACHE <= _cacheIndex[reg]) {
+      spilled |= 1 << reg;
+    }
+  }
+  _writeBack(spilled & _dirty);
+  _dirty &= ~spilled;
+  _movImm64(RAX, (uint64_t)fn);
+  _byte(0xff); _byte(0xd0);                              // call rax
+  _loadCached(spilled);
+}
+
+void EmuJit::_word(const uint16_t& w) {
+  memcpy(_cursor, &w, sizeof(w));
+  _cursor += sizeof(w);
+}
+
+void EmuJit::_dword(const uint32_t& d) {
+  memcpy(_cursor, &d, sizeof(d));
+  _cursor += sizeof(d);
+}
+
+void EmuJit::_qword(const uint64_t& q) {
+  memcpy(_cursor, &q, sizeof(q));
+  _cursor += sizeof(q);
+}
+
+void EmuJit::_rex(const bool& w, const int& reg, const int& index,
+                  const int& base, const bool& force) {
+  uint8_t rex = 0x40 | (w ? 0x8 : 0) | ((reg & 0x8) ? 0x4 : 0) |
+    ((index >= 0 && (index & 0x8)) ? 0x2 : 0) | ((base & 0x8) ? 0x1 : 0);
+  if (0x40 != rex || force) {
+    _byte(rex);
+  }
+}
+
+void EmuJit::_modrmMem(const int& reg, const int& base, const int& index,
+                       const int& scale, const int32_t& disp) {
+  uint8_t mod;
+  if (0 == disp && 5 != (base & 0x7)) {
+    mod = 0;
+  } else if (-128 <= disp && disp < 128) {
+    mod = 1;
+  } else {
+    mod = 2;
+  }
+  if (index < 0 && 4 != (base & 0x7)) {
+    _byte((mod << 6) | ((reg & 0x7) << 3) | (base & 0x7));
+  } else {
+    uint8_t ss = 8 == scale ? 3 : 4 == scale ? 2 : 2 == scale ? 1 : 0;
+    uint8_t idx = index < 0 ? 4 : (index & 0x7);
+    _byte((mod << 6) | ((reg & 0x7) << 3) | 4);
+    _byte((ss << 6) | (idx << 3) | (base & 0x7));
+  }
+  if (1 == mod) {
+    _byte((uint8_t)disp);
+  } else if (2 == mod) {
+    _dword((uint32_t)disp);
+  }
+}
+
+void EmuJit::_opMem(const uint8_t& prefix, const bool& w,
+                    const uint8_t *opcode, const int& opcode_len,
+                    const int& reg, const int& base, const int& index,
+                    const int& scale, const int32_t& disp) {
+  if (0 != prefix) {
+    _byte(prefix);
+  }
+  _rex(w, reg, index, base, false);
+  for (int i = 0; i < opcode_len; i++) {
+    _byte(opcode[i]);
+  }
+  _modrmMem(reg, base, index, scale, disp);
+}
+
+void EmuJit::_opReg(const uint8_t& prefix, const bool& w,
+                    const uint8_t *opcode, const int& opcode_len,
+                    const int& reg, const int& rm) {
+  if (0 != prefix) {
+    _byte(prefix);
+  }
+  _rex(w, reg, -1, rm, false);
+  for (int i = 0; i < opcode_len; i++) {
+    _byte(opcode[i]);
+  }
+  _byte(0xc0 | ((reg & 0x7) << 3) | (rm & 0x7));
+}
+
+void EmuJit::_movImm32(const int& reg, const uint32_t& imm) {
+  _rex(false, 0, -1, reg, false);
+  _byte(0xb8 + (reg & 0x7));
+  _dword(imm);
+}
+
+void EmuJit::_movImm64(const int& reg, const uint64_t& imm) {
+  _rex(true, 0, -1, reg, false);
+  _byte(0xb8 + (reg & 0x7));
+  _qword(imm);
+}
+
+void EmuJit::_cacheRegs(const uint16_t& slot) {
+  // Counts how often each guest register other than SP is used in the
+  // block and keeps the busiest ones in host registers, as long as they
+  // are used more than once. The ones the block writes before reading
+  // aren't loaded.
+  const uint8_t *mem = _processor->_mainMem;
+  int uses[NUM_REGISTERS] = { 0 };
+  uint16_t seen = 0;
+  uint16_t replaced = 0;
+  _blockPixels = false;
+  for (uint16_t length = 0; length < JIT_MAX_BLOCK; length++) {
+    const uint8_t *inst =
+      &mem[((slot + length) * INST_SIZE) & (MAIN_MEMORY_SIZE - 1)];
+    uint8_t opcode = normalizeOpcode(inst[0]);
+    if (isHostInst(opcode)) {
+      break;
+    }
+    uint8_t reg1 = inst[1] & 0xf;
+    if (OPCODE_PIXEL == opcode) {
+      _blockPixels = true;
+    }
+    switch (EMU_ISA[opcode].operands) {
+    case OPERANDS_REG_REG:
+      uses[inst[2] & 0xf]++;
+      seen |= 1 << (inst[2] & 0xf);
+      // Fall through
+    case OPERANDS_REG:
+    case OPERANDS_REG_IMM:
+      uses[reg1]++;
+      if (!(seen & (1 << reg1)) && replacesReg1(opcode)) {
+        replaced |= 1 << reg1;
+      }
+      seen |= 1 << reg1;
+      break;
+    default:
+      break;
+    }
+    if (endsBlock(opcode)) {
+      break;
+    }
+  }
+  _cached = 1 << REG_SP;
+  _cacheIndex[REG_SP] = 0;
+  _dirty = 0;
+  for (size_t i = _blockPixels ? 2 : 1; i < sizeof(CACHE_REGS); i++) {
+    int best = -1;
+    for (int reg = 0; reg < NUM_REGISTERS; reg++) {
+      if (!(_cached & (1 << reg)) && 1 < uses[reg] &&
+          (best < 0 || uses[best] < uses[reg])) {
+        best = reg;
+      }
+    }
+    if (best < 0) {
+      break;
+    }
+    _cached |= 1 << best;
+    _cacheIndex[best] = i;
+  }
+  _loadCached(_cached & ~replaced & ~(1 << REG_SP));
+  if (_blockPixels) {
+    const uint8_t xorRR[] = { 0x31 };
+    _opReg(0, false, xorRR, 1, CACHE_REGS[1],
+           CACHE_REGS[1]);                               // xor r14d, r14d
+  }
+}
+
+void EmuJit::_loadCached(const uint16_t& regs) {
+  // movzx host_reg, word [r12 + 2 * guest_reg] for each register
+  const uint8_t movzx16[] = { 0x0f, 0xb7 };
+  for (int reg = 0; reg < NUM_REGISTERS; reg++) {
+    if (regs & (1 << reg)) {
+      _opMem(0, false, movzx16, 2, CACHE_REGS[_cacheIndex[reg]],
+             REG_REGS, -1, 0, reg * 2);
+    }
+  }
+}
+
+void EmuJit::_writeBack(const uint16_t& regs) {
+  // mov word [r12 + 2 * guest_reg], host_reg for each register
+  const uint8_t mov[] = { 0x89 };
+  for (int reg = 0; reg < NUM_REGISTERS; reg++) {
+    if (regs & (1 << reg)) {
+      _opMem(0x66, false, mov, 1, CACHE_REGS[_cacheIndex[reg]],
+             REG_REGS, -1, 0, reg * 2);
+    }
+  }
+}
+
+void EmuJit::_loadReg(const int& host_reg, const uint8_t& guest_reg) {
+  if (_cached & (1 << guest_reg)) {
+    // mov host_reg, cached
+    const uint8_t movRR[] = { 0x89 };
+    _opReg(0, false, movRR, 1, CACHE_REGS[_cacheIndex[guest_reg]],
+           host_reg);
+    return;
+  }
+  // movzx host_reg, word [r12 + 2 * guest_reg]
+  const uint8_t movzx16[] = { 0x0f, 0xb7 };
+  _opMem(0, false, movzx16, 2, host_reg, REG_REGS, -1, 0, guest_reg * 2);
+}
+
+void EmuJit::_storeReg(const uint8_t& guest_reg, const int& host_reg) {
+  if (_cached & (1 << guest_reg)) {
+    // movzx cached, host_reg16
+    const uint8_t movzx16[] = { 0x0f, 0xb7 };
+    _opReg(0, false, movzx16, 2, CACHE_REGS[_cacheIndex[guest_reg]],
+           host_reg);
+    _dirty |= 1 << guest_reg;
+    return;
+  }
+  // mov word [r12 + 2 * guest_reg], host_reg
+  const uint8_t mov[] = { 0x89 };
+  _opMem(0x66, false, mov, 1, host_reg, REG_REGS, -1, 0, guest_reg * 2);
+}
+
+void EmuJit::_storeRegImm(const uint8_t& guest_reg, const uint16_t& value) {
+  if (_cached & (1 << guest_reg)) {
+    _movImm32(CACHE_REGS[_cacheIndex[guest_reg]], value);
+    _dirty |= 1 << guest_reg;
+    return;
+  }
+  // mov word [r12 + 2 * guest_reg], value
+  const uint8_t movImmM[] = { 0xc7 };
+  _opMem(0x66, false, movImmM, 1, 0, REG_REGS, -1, 0, guest_reg * 2);
+  _word(value);
+}
+
+void EmuJit::_loadMem() {
+  // Loads the big-endian word at the address in eax into ecx,
+  // wrapping around the top of memory. Clobbers edx.
+  const uint8_t movzx8[] = { 0x0f, 0xb6 };
+  const uint8_t movzx16[] = { 0x0f, 0xb7 };
+  const uint8_t shiftImm[] = { 0xc1 };
+  const uint8_t orRR[] = { 0x09 };
+  const uint8_t grp1[] = { 0x81 };
+  _opReg(0, false, grp1, 1, 7, RAX); _dword(0xffff);     // cmp eax, 0xffff
+  uint8_t *inside = _jump(CC_NE);
+  _opMem(0, false, movzx8, 2, RCX, REG_REGS, -1, 0,
+         _memDisp + 0xffff);                             // movzx ecx, [mem+0xffff]
+  _opReg(0, false, shiftImm, 1, 4, RCX); _byte(8);       // shl ecx, 8
+  _opMem(0, false, movzx8, 2, RDX, REG_REGS, -1, 0,
+         _memDisp);                                      // movzx edx, [mem]
+  _opReg(0, false, orRR, 1, RDX, RCX);                   // or ecx, edx
+  uint8_t *done = _jump(CC_ALWAYS);
+  _patch(inside);
+  _opMem(0, false, movzx16, 2, RCX, REG_REGS, RAX, 1,
+         _memDisp);                                      // movzx ecx, [mem+rax]
+  _opReg(0x66, false, shiftImm, 1, 0, RCX); _byte(8);    // rol cx, 8
+  _patch(done);
+}
+
+void EmuJit::_storeMem(const uint16_t& next_ip, const uint16_t& executed) {
+  // Stores the word in ecx big-endian at the address in eax, marks
+  // the decoded slots it touches and the one before them as stale,
+  // since that one may be fused with the first, and leaves the block if
+  // either byte landed on a flagged page. Clobbers edx, esi, edi.
+  const uint8_t movRR[] = { 0x89 };
+  const uint8_t movM8[] = { 0x88 };
+  const uint8_t movM8Imm[] = { 0xc6 };
+  const uint8_t movM16[] = { 0x89 };
+  const uint8_t movzx8[] = { 0x0f, 0xb6 };
+  const uint8_t movzx16[] = { 0x0f, 0xb7 };
+  const uint8_t shiftImm[] = { 0xc1 };
+  const uint8_t lea[] = { 0x8d };
+  const uint8_t orRR[] = { 0x09 };
+  const uint8_t grp1[] = { 0x81 };
+  _opReg(0, false, movRR, 1, RCX, RDX);                  // mov edx, ecx
+  _opReg(0, false, grp1, 1, 7, RAX); _dword(0xffff);     // cmp eax, 0xffff
+  uint8_t *inside = _jump(CC_NE);
+  _opReg(0, false, shiftImm, 1, 5, RDX); _byte(8);       // shr edx, 8
+  _opMem(0, false, movM8, 1, RDX, REG_REGS, -1, 0,
+         _memDisp + 0xffff);                             // mov [mem+0xffff], dl
+  _opMem(0, false, movM8, 1, RCX, REG_REGS, -1, 0,
+         _memDisp);                                      // mov [mem], cl
+  uint8_t *done = _jump(CC_ALWAYS);
+  _patch(inside);
+  _opReg(0x66, false, shiftImm, 1, 0, RDX); _byte(8);    // rol dx, 8
+  _opMem(0x66, false, movM16, 1, RDX, REG_REGS, RAX, 1,
+         _memDisp);                                      // mov [mem+rax], dx
+  _patch(done);
+  _opMem(0, false, lea, 1, RDX, RAX, -1, 0, 1);          // lea edx, [rax+1]
+  _opReg(0, false, movzx16, 2, RDX, RDX);                // movzx edx, dx
+  _opMem(0, false, lea, 1, RSI, RAX, -1, 0, -INST_SIZE); // lea esi, [rax-4]
+  _opReg(0, false, movzx16, 2, RSI, RSI);                // movzx esi, si
+  _opReg(0, false, shiftImm, 1, 5, RSI); _byte(2);       // shr esi, 2
+  _opMem(0, false, movM8Imm, 1, 0, REG_REGS, RSI, 8, _decodedDisp);
+  _byte(OPCODE_DECODE);                                  // mov [dec+rsi*8], DECODE
+  _opReg(0, false, movRR, 1, RAX, RSI);                  // mov esi, eax
+  _opReg(0, false, shiftImm, 1, 5, RSI); _byte(2);       // shr esi, 2
+  _opMem(0, false, movM8Imm, 1, 0, REG_REGS, RSI, 8, _decodedDisp);
+  _byte(OPCODE_DECODE);                                  // mov [dec+rsi*8], DECODE
+  _opReg(0, false, movRR, 1, RDX, RSI);                  // mov esi, edx
+  _opReg(0, false, shiftImm, 1, 5, RSI); _byte(2);       // shr esi, 2
+  _opMem(0, false, movM8Imm, 1, 0, REG_REGS, RSI, 8, _decodedDisp);
+  _byte(OPCODE_DECODE);                                  // mov [dec+rsi*8], DECODE
+  _opReg(0, false, movRR, 1, RAX, RSI);                  // mov esi, eax
+  _opReg(0, false, shiftImm, 1, 5, RSI); _byte(8);       // shr esi, 8
+  _opMem(0, false, movzx8, 2, RSI, REG_REGS, RSI, 1,
+         _pagesDisp);                                    // movzx esi, [pages+rsi]
+  _opReg(0, false, movRR, 1, RDX, RDI);                  // mov edi, edx
+  _opReg(0, false, shiftImm, 1, 5, RDI); _byte(8);       // shr edi, 8
+  _opMem(0, false, movzx8, 2, RDI, REG_REGS, RDI, 1,
+         _pagesDisp);                                    // movzx edi, [pages+rdi]
+  _opReg(0, false, orRR, 1, RDI, RSI);                   // or esi, edi
+  uint8_t *clean = _jump(CC_E);
+  _opMem(0x66, false, movM16, 1, RAX, REG_CTX, -1, 0,
+         offsetof(EmuJitContext, storeAddr));            // mov [rbx+storeAddr], ax
+  _opMem(0, false, movM8Imm, 1, 0, REG_CTX, -1, 0,
+         offsetof(EmuJitContext, storeExit));
+  _byte(1);                                              // mov [rbx+storeExit], 1
+  _exit(executed, false);
+  _movImm32(RAX, next_ip);
+  _jumpTo(_hostReturn);
+  _patch(clean);
+}
+
+void EmuJit::_loadMemConst(const uint16_t& addr) {
+  // Loads the big-endian word at a constant address into ecx
+  if (0xffff == addr) {
+    _movImm32(RAX, addr);
+    _loadMem();
+    return;
+  }
+  const uint8_t movzx16[] = { 0x0f, 0xb7 };
+  const uint8_t shiftImm[] = { 0xc1 };
+  _opMem(0, false, movzx16, 2, RCX, REG_REGS, -1, 0,
+         _memDisp + addr);                               // movzx ecx, [mem+addr]
+  _opReg(0x66, false, shiftImm, 1, 0, RCX); _byte(8);   // rol cx, 8
+}
+
+void EmuJit::_storeMemConst(const uint16_t& addr, const uint16_t& next_ip,
+                            const uint16_t& executed) {
+  // Same as _storeMem, but with the address known ahead of time
+  if (0xffff == addr) {
+    _movImm32(RAX, addr);
+    _storeMem(next_ip, executed);
+    return;
+  }
+  const uint8_t movRR[] = { 0x89 };
+  const uint8_t movM16[] = { 0x89 };
+  const uint8_t movImmM[] = { 0xc7 };
+  const uint8_t movM8Imm[] = { 0xc6 };
+  const uint8_t movzx8[] = { 0x0f, 0xb6 };
+  const uint8_t shiftImm[] = { 0xc1 };
+  const uint8_t orRR[] = { 0x09 };
+  const uint8_t testRR[] = { 0x85 };
+  uint16_t next = addr + 1;
+  _opReg(0, false, movRR, 1, RCX, RDX);                  // mov edx, ecx
+  _opReg(0x66, false, shiftImm, 1, 0, RDX); _byte(8);    // rol dx, 8
+  _opMem(0x66, false, movM16, 1, RDX, REG_REGS, -1, 0,
+         _memDisp + addr);                               // mov [mem+addr], dx
+  _opMem(0, false, movM8Imm, 1, 0, REG_REGS, -1, 0, _decodedDisp +
+         ((uint16_t)(addr - INST_SIZE) / INST_SIZE) *
+         sizeof(EmuDecodedInst));
+  _byte(OPCODE_DECODE);
+  _opMem(0, false, movM8Imm, 1, 0, REG_REGS, -1, 0, _decodedDisp +
+         (addr / INST_SIZE) * sizeof(EmuDecodedInst));
+  _byte(OPCODE_DECODE);
+  if (addr / INST_SIZE != next / INST_SIZE) {
+    _opMem(0, false, movM8Imm, 1, 0, REG_REGS, -1, 0, _decodedDisp +
+           (next / INST_SIZE) * sizeof(EmuDecodedInst));
+    _byte(OPCODE_DECODE);
+  }
+  _opMem(0, false, movzx8, 2, RSI, REG_REGS, -1, 0,
+         _pagesDisp + addr / MEMORY_PAGE_SIZE);          // movzx esi, [pages+page]
+  if (addr / MEMORY_PAGE_SIZE != next / MEMORY_PAGE_SIZE) {
+    _opMem(0, false, movzx8, 2, RDI, REG_REGS, -1, 0,
+           _pagesDisp + next / MEMORY_PAGE_SIZE);        // movzx edi, [pages+page]
+    _opReg(0, false, orRR, 1, RDI, RSI);                 // or esi, edi
+  }
+  _opReg(0, false, testRR, 1, RSI, RSI);                 // test esi, esi
+  uint8_t *clean = _jump(CC_E);
+  _opMem(0x66, false, movImmM, 1, 0, REG_CTX, -1, 0,
+         offsetof(EmuJitContext, storeAddr));
+  _word(addr);                                           // mov [rbx+storeAddr], addr
+  _opMem(0, false, movM8Imm, 1, 0, REG_CTX, -1, 0,
+         offsetof(EmuJitContext, storeExit));
+  _byte(1);                                              // mov [rbx+storeExit], 1
+  _exit(executed, false);
+  _movImm32(RAX, next_ip);
+  _jumpTo(_hostReturn);
+  _patch(clean);
+}
+
+uint8_t *EmuJit::_jump(const uint8_t& cond) {
+  // Emits a jump with a 32-bit displacement to be patched later,
+  // and returns where the displacement lives
+  if (CC_ALWAYS == cond) {
+    _byte(0xe9);
+  } else {
+    _byte(0x0f);
+    _byte(0x80 | cond);
+  }
+  uint8_t *rel = _cursor;
+  _dword(0);
+  return rel;
+}
+
+void EmuJit::_patch(uint8_t *rel) {
+  // Points the jump whose displacement is at rel to the cursor
+  _point(rel, _cursor);
+}
+
+void EmuJit::_jumpTo(const uint8_t *target) {
+  _byte(0xe9);
+  int32_t disp = (int32_t)(target - (_cursor + 4));
+  _dword((uint32_t)disp);
+}
+
+void EmuJit::_point(uint8_t *rel, const uint8_t *target) {
+  // Points the jump whose displacement is at rel somewhere else
+  int32_t disp = (int32_t)(target - (rel + 4));
+  memcpy(rel, &disp, sizeof(disp));
+}
+
+void EmuJit::_jumpToBlock(const uint16_t& target, const uint16_t& executed,
+                          const bool& flags) {
+  // Leaves the block for a constant target, straight into the block
+  // there if it is compiled. The address is in eax for the dispatcher
+  // and the host.
+  uint16_t slot = target / INST_SIZE;
+  bool loop = slot == _blockSlot && _blockChainable &&
+    target == slot * INST_SIZE;
+  _retire(executed, flags);
+  if (!loop) {
+    _flushPixels();
+  }
+  _movImm32(RAX, target);
+  if (loop) {
+    // A loop back to the start of this block keeps the guest registers
+    // where they are, which are already written back, and keeps on
+    // counting pixels
+    _checkBudget(executed);
+    _point(_jump(CC_BE), _blockLoaded);
+    _flushPixels();
+    _jumpTo(_hostReturn);
+    return;
+  }
+  uint8_t *rel = _jump(CC_ALWAYS);
+  _incoming[slot].push_back(rel);
+  const EmuJitBlock& block = _blocks[slot];
+  _point(rel, block.compiled && block.chainable ?
+              _entries[slot] : _dispatcher);
+}
+
+void EmuJit::_jumpToEntry() {
+  // Jumps to the entry for the address in eax. Each place this is
+  // emitted has its own indirect jump, which the host predicts better
+  // than one shared by every return.
+  const uint8_t grp5[] = { 0xff };
+  _movImm64(RCX, (uint64_t)_entries);
+  _opMem(0, false, grp5, 1, 4, RCX, RAX, 2, 0);          // jmp [rcx+rax*2]
+}
+
+uint8_t *EmuJit::_checkBudget(const uint16_t& length) {
+  // Compares the executed count plus the length of a block with the
+  // budget, and returns where the length lives
+  const uint8_t lea[] = { 0x8d };
+  const uint8_t cmpRM[] = { 0x3b };
+  // The displacement is made to take 32 bits, so that the length can
+  // be patched in later
+  uint32_t length32 = length;
+  _opMem(0, true, lea, 1, RCX, REG_EXECUTED, -1, 0,
+         0x7fffffff);                                    // lea rcx, [r15+length]
+  uint8_t *rel = _cursor - 4;
+  memcpy(rel, &length32, sizeof(length32));
+  _opMem(0, true, cmpRM, 1, RCX, REG_CTX, -1, 0,
+         offsetof(EmuJitContext, budget));               // cmp rcx, budget
+  return rel;
+}
+
+void EmuJit::_exit(const uint16_t& executed, const bool& flags) {
+  _retire(executed, flags);
+  _flushPixels();
+}
+
+void EmuJit::_retire(const uint16_t& executed, const bool& flags) {
+  // Writes back the guest registers changed so far other than SP, which
+  // goes back on the way out to the host, and records the number of
+  // instructions retired and the state of the flags
+  const uint8_t grp1[] = { 0x81 };
+  const uint8_t movM32[] = { 0x89 };
+  const uint8_t movM8Imm[] = { 0xc6 };
+  _writeBack(_dirty & ~(1 << REG_SP));
+  _opReg(0, true, grp1, 1, 0, REG_EXECUTED); _dword(executed); // add r15, n
+  uint8_t flagOpcode = OPCODE_NOP;
+  if (flags && OPCODE_NOP != _liveFlags) {
+    _opMem(0, false, movM32, 1, RCX, REG_CTX, -1, 0,
+           offsetof(EmuJitContext, flagDest));
+    _opMem(0, false, movM32, 1, RDX, REG_CTX, -1, 0,
+           offsetof(EmuJitContext, flagSrc));
+    _opMem(0, false, movM32, 1, RAX, REG_CTX, -1, 0,
+           offsetof(EmuJitContext, flagResult));
+    flagOpcode = _liveFlags;
+  }
+  _opMem(0, false, movM8Imm, 1, 0, REG_CTX, -1, 0,
+         offsetof(EmuJitContext, flagOpcode));
+  _byte(flagOpcode);
+}
+
+void EmuJit::_flushPixels() {
+  // Adds the pixels drawn since the block was entered to the count in
+  // video memory. Clobbers ecx.
+  if (!_blockPixels) {
+    return;
+  }
+  EmuVideoMemory *vid = _processor->_vidMem;
+  int32_t disp = (const uint8_t *)&vid->_pixelWrites - (const uint8_t *)vid;
+  const uint8_t addMR[] = { 0x01 };
+  _movImm64(RCX, (uint64_t)vid);
+  _opMem(0, true, addMR, 1, CACHE_REGS[1], RCX, -1, 0,
+         disp);                                          // add [pixelWrites], r14
+}
@@ -0,0 +1,180 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#ifndef EMU_JIT_H
+#define EMU_JIT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "defs.h"
+
+class EmuProcessor;
+
+// State shared between the host and a compiled block. A block
+// returns the address of the next instruction and reports how many
+// instructions it retired and how it left the flags.
+struct EmuJitContext {
+  uint64_t executed;
+  // Blocks chain into each other until running the next block
+  // would take the executed count past the budget
+  uint64_t budget;
+  uint32_t flagDest;
+  uint32_t flagSrc;
+  uint32_t flagResult;
+  // The opcode of the ALU instruction that last set the flags,
+  // or OPCODE_NOP if the flags were cleared
+  uint8_t flagOpcode;
+  // Set if the block stopped after a store to a flagged page
+  uint8_t storeExit;
+  uint16_t storeAddr;
+};
+
+typedef uint16_t (*EmuJitBlockFn)(EmuJitContext *ctx);
+
+struct EmuJitBlock {
+  EmuJitBlockFn fn;
+  // Number of instructions in the block, or zero if the instruction
+  // at this address is always run by the interpreter
+  uint16_t length;
+  bool compiled;
+  // Whether other blocks may jump straight into this one
+  bool chainable;
+};
+
+// Translates basic blocks of Consolite instructions into x86-64
+// machine code. Blocks end at a jump, call or return, and stop
+// short of TIME and TIMERST, which are left to the interpreter. INPUT
+// and RND call back into the processor from the block, and PIXEL writes
+// video memory itself. The code buffer is only ever writable or
+// executable, never both.
+//
+// Blocks jump straight into each other. Jumps to a constant address,
+// including calls and falling through to the next block, are direct
+// jumps that are pointed at the block for that address once it is
+// compiled, and back at the dispatcher when it is thrown away. Returns
+// and jumps to a register look the address up in a table of entry
+// points, each with an indirect jump of its own. Every block checks
+// on the way in that it fits in what is left of the budget.
+//
+// The guest registers a block uses most are loaded into host registers
+// on the way in, and the ones it changed are written back on every way
+// out, except SP, which stays in a host register until the host is
+// returned to. A block that loops back to its own start skips the loads.
+class EmuJit {
+ public:
+  EmuJit(EmuProcessor *processor);
+  ~EmuJit();
+  bool hasError() { return _error; }
+  uint64_t run(const uint64_t& max_instructions);
+  void invalidate(const uint16_t& addr);
+  void flush();
+
+ private:
+  // Helpers called from compiled code
+  static int _condition(EmuProcessor *processor, int opcode);
+  static int _input(EmuProcessor *processor, int input_id);
+  static int _random(EmuProcessor *processor);
+  void _setWritable(const bool& writable);
+  const EmuJitBlock& _compile(const uint16_t& slot);
+  bool _compileInst(const uint16_t& slot, const uint16_t& index);
+  void _emitDispatcher();
+  void _registerBlock(const uint16_t& slot, const uint16_t& length);
+
+  // Machine code emitters
+  void _byte(const uint8_t& b) { *_cursor++ = b; }
+  void _word(const uint16_t& w);
+  void _dword(const uint32_t& d);
+  void _qword(const uint64_t& q);
+  void _rex(const bool& w, const int& reg, const int& index,
+            const int& base, const bool& force);
+  void _modrmMem(const int& reg, const int& base, const int& index,
+                 const int& scale, const int32_t& disp);
+  void _opMem(const uint8_t& prefix, const bool& w,
+              const uint8_t *opcode, const int& opcode_len,
+              const int& reg, const int& base, const int& index,
+              const int& scale, const int32_t& disp);
+  void _opReg(const uint8_t& prefix, const bool& w,
+              const uint8_t *opcode, const int& opcode_len,
+              const int& reg, const int& rm);
+  void _movImm32(const int& reg, const uint32_t& imm);
+  void _movImm64(const int& reg, const uint64_t& imm);
+  void _aluInPlace(const uint8_t& opcode, const uint8_t& reg1,
+                   const uint8_t& reg2);
+  void _drawPixel(const uint8_t& reg_x, const uint8_t& reg_y);
+  void _callHelper(const void *fn);
+  void _cacheRegs(const uint16_t& slot);
+  void _loadCached(const uint16_t& regs);
+  void _writeBack(const uint16_t& regs);
+  void _loadReg(const int& host_reg, const uint8_t& guest_reg);
+  void _storeReg(const uint8_t& guest_reg, const int& host_reg);
+  void _storeRegImm(const uint8_t& guest_reg, const uint16_t& value);
+  void _loadMem();
+  void _loadMemConst(const uint16_t& addr);
+  void _storeMemConst(const uint16_t& addr, const uint16_t& next_ip,
+                      const uint16_t& executed);
+  void _storeMem(const uint16_t& next_ip, const uint16_t& executed);
+  uint8_t *_jump(const uint8_t& cond);
+  void _patch(uint8_t *rel);
+  void _point(uint8_t *rel, const uint8_t *target);
+  void _jumpTo(const uint8_t *target);
+  void _jumpToBlock(const uint16_t& target, const uint16_t& executed,
+                    const bool& flags);
+  void _jumpToEntry();
+  uint8_t *_checkBudget(const uint16_t& length);
+  void _exit(const uint16_t& executed, const bool& flags);
+  void _retire(const uint16_t& executed, const bool& flags);
+  void _flushPixels();
+
+  EmuProcessor *_processor;
+  EmuJitBlock _blocks[MAIN_MEMORY_SIZE / INST_SIZE];
+  // Start slots of the compiled blocks that overlap each page
+  std::vector<uint16_t> _pageBlocks[MAIN_MEMORY_SIZE / MEMORY_PAGE_SIZE];
+  // Where compiled code goes to run the instruction in each slot: the
+  // body of the block there if it can be chained to, and otherwise
+  // back to the host
+  uint8_t *_entries[MAIN_MEMORY_SIZE / INST_SIZE];
+  // The displacements of the direct jumps to each slot, which point at
+  // the block there while it is compiled and at the dispatcher while
+  // it isn't
+  std::vector<uint8_t *> _incoming[MAIN_MEMORY_SIZE / INST_SIZE];
+  uint8_t *_code;
+  uint8_t *_cursor;
+  // Jumps to the entry for the address in eax
+  uint8_t *_dispatcher;
+  // Restores registers and returns to the host
+  uint8_t *_hostReturn;
+  // The ALU opcode whose operands are live in ecx, edx and eax, or
+  // OPCODE_NOP if the previous instruction left the flags cleared
+  uint8_t _liveFlags;
+  // Set if the x86 flags already hold the flags for _liveFlags, and
+  // ecx, edx and eax don't hold its operands
+  bool _hostFlags;
+  // The block being compiled
+  uint16_t _blockSlot;
+  uint8_t *_blockBody;
+  uint8_t *_blockLength;
+  // Where the block goes on from once its guest registers are loaded
+  uint8_t *_blockLoaded;
+  bool _blockChainable;
+  // Whether the block draws pixels, which it counts in the second of
+  // the cache registers instead of keeping a guest register there
+  bool _blockPixels;
+  // The guest registers kept in host registers in the block being
+  // compiled, the index into CACHE_REGS of each one, and the ones that
+  // have been changed since they were last written back
+  uint16_t _cached;
+  uint8_t _cacheIndex[NUM_REGISTERS];
+  uint16_t _dirty;
+  // Where main memory, the decoded slots, the page flags and the color
+  // register are relative to the guest registers
+  int32_t _memDisp;
+  int32_t _decodedDisp;
+  int32_t _pagesDisp;
+  int32_t _colorDisp;
+  bool _error;
+};
+
+#endif
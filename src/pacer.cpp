@@ -0,0 +1,53 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#include <thread>
+#include "pacer.h"
+
+EmuPacer::EmuPacer(const double& target_mhz,
+                   const uint64_t& instruction_count) {
+  _targetMhz = target_mhz;
+  // Slices should take about PACE_SLICE_MICROS at the target rate,
+  // so that the sleeps are short and the rate stays smooth
+  _sliceSize = EXECUTE_SLICE;
+  if (0 < _targetMhz) {
+    double slice = _targetMhz * PACE_SLICE_MICROS;
+    if (slice < 1) {
+      _sliceSize = 1;
+    } else if (slice < EXECUTE_SLICE) {
+      _sliceSize = slice;
+    }
+  }
+  _startTime = _baseTime = Clock::now();
+  _startCount = _baseCount = instruction_count;
+}
+
+void EmuPacer::pace(const uint64_t& instruction_count) {
+  if (0 >= _targetMhz) {
+    return;
+  }
+  // The time that we should have reached this instruction count
+  std::chrono::duration<double, std::micro> due(
+    (instruction_count - _baseCount) / _targetMhz);
+  Clock::time_point deadline =
+    _baseTime + std::chrono::duration_cast<Clock::duration>(due);
+  Clock::time_point now = Clock::now();
+  if (now < deadline) {
+    std::this_thread::sleep_until(deadline);
+  } else if (std::chrono::microseconds(PACE_MAX_LAG_MICROS) <
+             now - deadline) {
+    _baseTime = now;
+    _baseCount = instruction_count;
+  }
+}
+
+double EmuPacer::getAchievedMhz(const uint64_t& instruction_count) {
+  std::chrono::duration<double, std::micro> elapsed =
+    Clock::now() - _startTime;
+  if (0 >= elapsed.count()) {
+    return 0;
+  }
+  return (instruction_count - _startCount) / elapsed.count();
+}
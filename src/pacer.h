@@ -0,0 +1,37 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#ifndef EMU_PACER_H
+#define EMU_PACER_H
+
+#include <stdint.h>
+#include <chrono>
+#include "defs.h"
+
+// Keeps the processor running at a target instruction rate. The
+// processor runs in slices, and after each one the pacer compares the
+// instruction count against a monotonic clock and sleeps off any time
+// it has gained. A target of zero means run as fast as possible.
+class EmuPacer {
+ public:
+  EmuPacer(const double& target_mhz, const uint64_t& instruction_count);
+  uint64_t getSliceSize() { return _sliceSize; }
+  void pace(const uint64_t& instruction_count);
+  double getAchievedMhz(const uint64_t& instruction_count);
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+  double _targetMhz;
+  uint64_t _sliceSize;
+  // The point that the target rate is measured from. It moves
+  // forward if we fall far behind, so that the processor does not
+  // race to catch up after a stall.
+  Clock::time_point _baseTime;
+  uint64_t _baseCount;
+  Clock::time_point _startTime;
+  uint64_t _startCount;
+};
+
+#endif
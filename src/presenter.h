@@ -0,0 +1,41 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#ifndef EMU_PRESENTER_H
+#define EMU_PRESENTER_H
+
+#include <vector>
+#include "vidmem.h"
+
+// The ways that frames can be put on the screen
+enum EmuPresentMode {
+  // MIT-SHM if the X server supports it, otherwise cairo
+  PRESENT_AUTO,
+  // Scales into a shared memory XImage and puts it with XShmPutImage
+  PRESENT_SHM,
+  // Scales and paints through a cairo Xlib surface
+  PRESENT_CAIRO
+};
+
+// A run of rows of video memory that changed since the last frame
+struct EmuDamage {
+  int firstRow;
+  int numRows;
+};
+
+// Puts frames of video memory into the window, scaled to fit it
+class EmuPresenter {
+ public:
+  virtual ~EmuPresenter() { }
+  virtual const char *getName() = 0;
+  // Returns false if frames can't be presented at the new size
+  virtual bool resize(const int& width, const int& height) = 0;
+  // Presents the damaged rows of the frame that the video memory's
+  // presenter side has acquired
+  virtual void present(EmuVideoMemory *vid_mem,
+                       const std::vector<EmuDamage>& damage) = 0;
+};
+
+#endif
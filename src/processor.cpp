@@ -3,15 +3,40 @@
  * Copyright (c) 2015 Robert Fotino, All Rights Reserved
  */
 
+#include <chrono>
 #include <ctime>
 #include <iostream>
 #include <fstream>
 #include <string.h>
 #include "processor.h"
+#include "jit.h"
+#include "pacer.h"
+#include "profiler.h"
+#include "tracer.h"
+#include "debugger.h"
+#include "rewind.h"
+#include "telemetry.h"
 
-EmuProcessor::EmuProcessor(EmuWindow *window,
+EmuProcessor::EmuProcessor(EmuIO *io,
                            const std::string& infile_name)
-                           : _window(window),
+                           : _io(io),
+                             _vidMem(io->getVideoMemory()),
+                             _engine(ENGINE_THREADED),
+                             _jit(nullptr),
+                             _profiler(nullptr),
+                             _tracer(nullptr),
+                             _debugger(nullptr),
+                             _rewind(nullptr),
+                             _telemetry(nullptr),
+                             _virtualClock(0),
+                             _instructionCount(0),
+                             _threadedCount(0),
+                             _fusedCount(0),
+                             _targetMhz(0),
+                             _achievedMhz(0),
+                             _idleSleep(true),
+                             _parkCount(0),
+                             _parkedNanos(0),
                              _error(false),
                              _running(true) {
   // Open up the input file
@@ -42,6 +67,7 @@ EmuProcessor::EmuProcessor(EmuWindow *window,
 
   // Read file contents into main memory
   memset(_mainMem, 0, sizeof(_mainMem));
+  memset(_pageFlags, 0, sizeof(_pageFlags));
   char c;
   uint16_t pos = 0;
   while (input.get(c)) {
@@ -49,75 +75,363 @@ EmuProcessor::EmuProcessor(EmuWindow *window,
     pos++;
   }
 
+  // Predecode every instruction slot of main memory
+  for (int slot = 0; slot < MAIN_MEMORY_SIZE / INST_SIZE; slot++) {
+    _decode(slot);
+  }
+
   // Initialize registers and other data
   memset(_registers, 0, sizeof(_registers));
   _instructionPointer = 0;
   _colorRegister = 0;
-  _overflowFlag = false;
-  _carryFlag = false;
-  _zeroFlag = false;
-  _signFlag = false;
+  _clearFlags();
+  _resetTimer(0);
+
+  // Seeds the random number generator (crude, but you probably
+  // aren't going to be running this emulator more than once
+  // per second).
+  setRandomSeed(time(nullptr));
+}
+
+EmuProcessor::~EmuProcessor() {
+  delete _jit;
+}
+
+void EmuProcessor::setEngine(const EmuEngine& engine) {
+  if (ENGINE_JIT == engine && nullptr == _jit) {
+    _jit = new EmuJit(this);
+    if (_jit->hasError()) {
+      std::cerr << "Warning: Falling back to the threaded interpreter."
+                << std::endl;
+      delete _jit;
+      _jit = nullptr;
+      _engine = ENGINE_THREADED;
+      return;
+    }
+  }
+  _engine = engine;
+}
+
+void EmuProcessor::setTracer(EmuTracer *tracer) {
+  _tracer = tracer;
+  if (nullptr != tracer) {
+    tracer->begin(_instructionCount);
+    // Decode every slot again without fusing, so that each instruction
+    // goes through dispatch and gets its own record
+    for (int slot = 0; slot < MAIN_MEMORY_SIZE / INST_SIZE; slot++) {
+      _decoded[slot].handler = OPCODE_DECODE;
+    }
+  }
+}
+
+void EmuProcessor::setDebugger(EmuDebugger *debugger) {
+  _debugger = debugger;
+  if (nullptr != debugger) {
+    debugger->attach(this);
+  }
 }
 
-void EmuProcessor::_push(const uint16_t& val) {
+void EmuProcessor::setRewind(EmuRewind *rewind) {
+  _rewind = rewind;
+  if (nullptr != rewind) {
+    rewind->attach(this);
+  }
+}
+
+void EmuProcessor::_storeHook(const uint16_t& addr) {
+  // A store touched a page with one of the page flags set
+  uint16_t next = addr + 1;
+  if (_pageFlags[addr / MEMORY_PAGE_SIZE] & PAGE_FLAG_JIT) {
+    _jit->invalidate(addr);
+  }
+  if (_pageFlags[next / MEMORY_PAGE_SIZE] & PAGE_FLAG_JIT) {
+    _jit->invalidate(next);
+  }
+  // The pages now differ from the last rewind checkpoint, and further
+  // stores to them don't need to come through here until the next one
+  _pageFlags[addr / MEMORY_PAGE_SIZE] &= ~PAGE_FLAG_REWIND;
+  _pageFlags[next / MEMORY_PAGE_SIZE] &= ~PAGE_FLAG_REWIND;
+  if (((_pageFlags[addr / MEMORY_PAGE_SIZE] |
+        _pageFlags[next / MEMORY_PAGE_SIZE]) & PAGE_FLAG_WATCH) &&
+      (_debugger->isWatched(addr) || _debugger->isWatched(next))) {
+    // Stop before the next instruction. Every slot is decoded again
+    // before it runs, and the debugger has them decoded to stop.
+    _debugger->watchHit(_debugger->isWatched(addr) ? addr : next);
+    for (int slot = 0; slot < MAIN_MEMORY_SIZE / INST_SIZE; slot++) {
+      _decoded[slot].handler = OPCODE_DECODE;
+    }
+  }
+}
+
+// The value is a copy, since PUSH SP pushes SP as it was before
+void EmuProcessor::_push(uint16_t val) {
   _registers[REG_SP] += 2;
-  uint16_t sp = _registers[REG_SP];
-  _mainMem[sp] = val >> 8;
-  _mainMem[sp+1] = val & 0xff;
+  _store(_registers[REG_SP], val);
 }
 
 uint16_t EmuProcessor::_pop() {
-  uint16_t sp = _registers[REG_SP];
-  uint16_t val = (_mainMem[sp] << 8) | _mainMem[sp+1];
+  uint16_t val = _load(_registers[REG_SP]);
   _registers[REG_SP] -= 2;
   return val;
 }
 
+void EmuProcessor::setVirtualClock(const uint64_t& instructions_per_milli) {
+  // Before anything has run the timer starts from zero in the new time
+  // base, so how long setting up took doesn't show up in TIME.
+  // Otherwise the time since the last TIMERST is carried over.
+  uint64_t elapsed = _timeNow(_instructionCount) - _timerReset;
+  uint64_t units = _timeUnitsPerMilli();
+  _virtualClock = instructions_per_milli;
+  if (0 == _instructionCount) {
+    _timerReset = _timeNow(_instructionCount);
+  } else {
+    _timerReset = _timeNow(_instructionCount) -
+                  (uint64_t)((double)elapsed * _timeUnitsPerMilli() / units);
+  }
+}
+
+uint64_t EmuProcessor::_timeNow(const uint64_t& instruction_count) {
+  // Virtual time is counted in instructions, and real time in
+  // nanoseconds of the monotonic clock
+  if (0 != _virtualClock) {
+    return instruction_count;
+  }
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t EmuProcessor::_timeUnitsPerMilli() {
+  return 0 != _virtualClock ? _virtualClock : 1000000;
+}
+
+uint16_t EmuProcessor::_time(const uint64_t& instruction_count) {
+  // Milliseconds since the last TIMERST
+  return (_timeNow(instruction_count) - _timerReset) / _timeUnitsPerMilli();
+}
+
+void EmuProcessor::_resetTimer(const uint64_t& instruction_count) {
+  _timerReset = _timeNow(instruction_count);
+}
+
 void EmuProcessor::_setInstructionPointer(const uint16_t& ip) {
   // Clear out the bottom two bits, because the instruction
   // pointer must be 4-byte aligned.
   _instructionPointer = ip & 0xfffc;
 }
 
-void EmuProcessor::_setFlags(const uint32_t& dest,
-                             const uint32_t& src,
-                             const uint32_t& result,
-                             const uint8_t& opcode) {
-  // Overflow set if we added two positives and got a negative,
-  // added two negatives and got a positive, subtracted a positive
-  // from a negative and got a positive, or subtracted a negative
-  // from a positive and got a negative
-  if (OPCODE_ADD == opcode) {
-    _overflowFlag =
-      ((0x8000 & dest) && (0x8000 & src) && !(0x8000 & result)) ||
-      (!(0x8000 & dest) && !(0x8000 & src) && (0x8000 & result));
-  } else if (OPCODE_SUB == opcode || OPCODE_CMP == opcode) {
-    _overflowFlag =
-      ((0x8000 & dest) && !(0x8000 & src) && !(0x8000 & result)) ||
-      (!(0x8000 & dest) && (0x8000 & src) && (0x8000 & result));
-  } else {
-    _overflowFlag = false;
+bool EmuProcessor::_condition(const uint8_t& opcode) {
+  // Whether the conditional jump with the given opcode is taken
+  switch (opcode) {
+  case OPCODE_JEQ: return _zeroFlag();
+  case OPCODE_JNE: return !_zeroFlag();
+  case OPCODE_JG:  return !_zeroFlag() && _signFlag() == _overflowFlag();
+  case OPCODE_JGE: return _signFlag() == _overflowFlag();
+  case OPCODE_JA:  return !_carryFlag() && !_zeroFlag();
+  case OPCODE_JAE: return !_carryFlag();
+  case OPCODE_JL:  return _signFlag() != _overflowFlag();
+  case OPCODE_JLE: return _signFlag() != _overflowFlag() || _zeroFlag();
+  case OPCODE_JB:  return _carryFlag();
+  case OPCODE_JBE: return _carryFlag() || _zeroFlag();
+  case OPCODE_JO:  return _overflowFlag();
+  case OPCODE_JNO: return !_overflowFlag();
+  case OPCODE_JS:  return _signFlag();
+  case OPCODE_JNS: return !_signFlag();
+  default:         return true;
   }
-  // Carry set if c is too large to fit into 16 bits.
-  _carryFlag = 0xffff < result;
-  // Zero set if the result was zero.
-  _zeroFlag = !(0xffff & result);
-  // Sign flag set if the sign bit of the result is set.
-  _signFlag = 0x8000 & result;
 }
 
 void EmuProcessor::execute() {
-  // The value of the clock at the last time we encountered
-  // a TIMERST instruction.
-  clock_t timeSinceRst = clock();
+  // Run in slices so that the running flag does not have to be
+  // checked on every instruction, and sleep between them when we
+  // are ahead of the target rate or waiting on the clock or input
+  EmuPacer pacer(_targetMhz, _instructionCount);
+  uint64_t slice = pacer.getSliceSize();
+  while (_running) {
+    if (nullptr != _rewind && !_rewind->update()) {
+      // Held on a checkpoint that was stepped back to
+      _vidMem->publishIfRequested();
+      continue;
+    }
+    // Changes to input from here on wake up a park after the slice
+    uint32_t inputs = _io->getInputGeneration();
+    run(slice);
+    _vidMem->publishIfRequested();
+    slice = pacer.getSliceSize();
+    if (_idleSleep && 0 == _virtualClock &&
+        _idleLoop(_instructionPointer)) {
+      _park(inputs);
+      // Check again after a few times around the loop, which is most
+      // likely still waiting
+      if (IDLE_PROBE_SLICE < slice) {
+        slice = IDLE_PROBE_SLICE;
+      }
+    }
+    pacer.pace(_instructionCount);
+  }
+  _achievedMhz = pacer.getAchievedMhz(_instructionCount);
+}
 
-  // Seeds the random number generator (crude, but you probably
-  // aren't going to be running this emulator more than once
-  // per second).
-  srand(time(nullptr));
+bool EmuProcessor::_idleLoop(const uint16_t& ip) {
+  // Find the branch back to the start of the loop that ip is in,
+  // following the code on from ip past any branches out of it
+  uint16_t start = 0;
+  uint16_t end = ip;
+  int i;
+  for (i = 0; i < IDLE_MAX_LOOP; i++, end += INST_SIZE) {
+    uint8_t opcode = _mainMem[end];
+    uint16_t target = ((_mainMem[end + 1] << 8) | _mainMem[end + 2]) & 0xfffc;
+    bool branch = OPCODE_JEQ <= opcode && opcode <= OPCODE_JNS;
+    if ((OPCODE_JMPI == opcode || branch) && target <= ip &&
+        ip - target < IDLE_MAX_LOOP * INST_SIZE) {
+      start = target;
+      break;
+    } else if (OPCODE_JMPI == opcode || OPCODE_JMP == opcode) {
+      return false;
+    }
+  }
+  if (IDLE_MAX_LOOP == i) {
+    return false;
+  }
 
-  while (_running) {
+  // The loop is only waiting if it has no effects but on registers,
+  // and it works out every register it writes afresh each time
+  // around, so that nothing changes until TIME or INPUT does. Flags
+  // never outlive the instruction after the one that set them.
+  uint16_t written = 0;
+  uint16_t carried = 0;
+  for (uint16_t addr = start; ; addr += INST_SIZE) {
+    const uint8_t *inst = &_mainMem[addr];
+    uint16_t reg1 = 1 << (inst[1] & 0xf);
+    uint16_t reg2 = 1 << (inst[2] & 0xf);
+    uint16_t target = ((inst[1] << 8) | inst[2]) & 0xfffc;
+    uint16_t reads = 0;
+    uint16_t writes = 0;
+    switch (inst[0]) {
+    case OPCODE_NOP:
+      break;
+    case OPCODE_INPUT:
+    case OPCODE_LOAD:
+    case OPCODE_MOV:
+      reads = reg2;
+      writes = reg1;
+      break;
+    case OPCODE_LOADI:
+    case OPCODE_MOVI:
+    case OPCODE_TIME:
+      writes = reg1;
+      break;
+    case OPCODE_ADD:
+    case OPCODE_SUB:
+    case OPCODE_MUL:
+    case OPCODE_DIV:
+    case OPCODE_AND:
+    case OPCODE_OR:
+    case OPCODE_XOR:
+    case OPCODE_SHL:
+    case OPCODE_SHRA:
+    case OPCODE_SHRL:
+      reads = reg1 | reg2;
+      writes = reg1;
+      break;
+    case OPCODE_CMP:
+    case OPCODE_TST:
+      reads = reg1 | reg2;
+      break;
+    case OPCODE_JMPI:
+    case OPCODE_JEQ:
+    case OPCODE_JNE:
+    case OPCODE_JG:
+    case OPCODE_JGE:
+    case OPCODE_JA:
+    case OPCODE_JAE:
+    case OPCODE_JL:
+    case OPCODE_JLE:
+    case OPCODE_JB:
+    case OPCODE_JBE:
+    case OPCODE_JO:
+    case OPCODE_JNO:
+    case OPCODE_JS:
+    case OPCODE_JNS:
+      // Branches may only leave the loop or start it over, so that
+      // it runs in order
+      if (start < target && target <= end) {
+        return false;
+      }
+      break;
+    default:
+      return false;
+    }
+    carried |= reads & ~written;
+    written |= writes;
+    if (end == addr) {
+      break;
+    }
+  }
+  return !(carried & written);
+}
+
+void EmuProcessor::_park(const uint32_t& input_generation) {
+  // Sleep until TIME next counts up a millisecond, or an input changes
+  uint64_t now = _timeNow(_instructionCount);
+  uint64_t tick = now + 1000000 - (now - _timerReset) % 1000000;
+  _io->waitForInput(input_generation,
+                    std::chrono::steady_clock::time_point(
+                      std::chrono::nanoseconds(tick)));
+  _parkCount++;
+  _parkedNanos += _timeNow(_instructionCount) - now;
+}
+
+uint64_t EmuProcessor::run(const uint64_t& max_instructions) {
+  // Each engine adds what it ran to the instruction count itself, so
+  // that the count is exact wherever the virtual clock is read
+  uint64_t executed;
+  EmuNullObserver observer;
+  if (nullptr != _debugger && _debugger->isStopping()) {
+    // Hand over to the debugger until it lets us go on, counting the
+    // instructions it stepped through
+    uint64_t start = _instructionCount;
+    _debugger->console();
+    executed = _instructionCount - start;
+  } else if (nullptr != _profiler) {
+    executed = _runSwitch(max_instructions, *_profiler);
+  } else if (nullptr != _tracer) {
+    executed = _runThreaded<true>(max_instructions);
+  } else if (nullptr != _debugger) {
+    executed = _runThreaded<false>(max_instructions);
+  } else {
+    switch (_engine) {
+    case ENGINE_SWITCH:
+      executed = _runSwitch(max_instructions, observer);
+      break;
+    case ENGINE_JIT:
+      executed = _jit->run(max_instructions);
+      break;
+    case ENGINE_THREADED:
+    default:
+      executed = _runThreaded<false>(max_instructions);
+      break;
+    }
+  }
+  if (nullptr != _telemetry) {
+    _telemetry->retired(_instructionCount, _vidMem->getPixelWrites(),
+                        _vidMem->getPublishedFrames());
+  }
+  return executed;
+}
+
+void EmuProcessor::_step() {
+  // Runs one instruction wherever the processor is, for the debugger
+  EmuNullObserver observer;
+  _runSwitch(1, observer);
+}
+
+template <class Observer>
+uint64_t EmuProcessor::_runSwitch(const uint64_t& max_instructions,
+                                  Observer& observer) {
+  uint64_t executed = 0;
+  while (executed < max_instructions) {
     // Execute next instruction
+    observer.onInstruction(_instructionPointer);
     uint8_t *inst = &_mainMem[_instructionPointer];
     uint8_t opcode = inst[0];
     uint8_t arg1 = inst[1];
@@ -127,10 +441,6 @@ void EmuProcessor::execute() {
     uint16_t argA = (inst[1] << 8) | inst[2];
     uint16_t argB = (inst[2] << 8) | inst[3];
 
-    uint32_t dest = _registers[reg1];
-    uint32_t src = _registers[reg2];
-    uint32_t result;
-
     uint16_t nextInstPtr = _instructionPointer + INST_SIZE;
     bool clearFlags = true;
 
@@ -143,7 +453,7 @@ void EmuProcessor::execute() {
       // INPUT DEST SRC
       // Where DEST is the register where the input data will be
       // stored and SRC holds the input ID that we want to check
-      _registers[reg1] = _window->getInput(src);
+      _registers[reg1] = _io->getInput(_registers[reg2]);
       break;
     case OPCODE_CALL:
       // CALL ADDR
@@ -151,6 +461,7 @@ void EmuProcessor::execute() {
       // address within the current instruction.
       _push(_instructionPointer);
       nextInstPtr = argA;
+      observer.onCall(nextInstPtr & 0xfffc);
       break;
     case OPCODE_RET:
       // RET NUM
@@ -158,20 +469,21 @@ void EmuProcessor::execute() {
       // argument, and jump to it.
       nextInstPtr = _pop() + INST_SIZE;
       _registers[REG_SP] -= arg1;
+      observer.onReturn();
       break;
     case OPCODE_LOAD:
       // LOAD DEST SRC
       // Load the memory pointed to by SRC and put it in DEST.
-      _registers[reg1] = (_mainMem[src] << 8) | _mainMem[src+1];
+      _registers[reg1] = _load(_registers[reg2]);
       break;
     case OPCODE_LOADI:
       // LOADI DEST ADDR
       // Load the memory at ADDR and put it in DEST.
-      _registers[reg1] = (_mainMem[argB] << 8) | _mainMem[argB+1];
+      _registers[reg1] = _load(argB);
       break;
     case OPCODE_MOV:
       // MOV DEST SRC
-      _registers[reg1] = src;
+      _registers[reg1] = _registers[reg2];
       break;
     case OPCODE_MOVI:
       // MOV DEST VALUE
@@ -179,7 +491,7 @@ void EmuProcessor::execute() {
       break;
     case OPCODE_PUSH:
       // PUSH REG
-      _push(dest);
+      _push(_registers[reg1]);
       break;
     case OPCODE_POP:
       // POP REG
@@ -187,92 +499,68 @@ void EmuProcessor::execute() {
       break;
     case OPCODE_ADD:
       // ADD DEST SRC
-      _registers[reg1] += src;
-      // Set flags
-      result = dest + src;
+      _alu<OPCODE_ADD>(reg1, _registers[reg1], _registers[reg2]);
       clearFlags = false;
       break;
     case OPCODE_SUB:
       // SUB DEST SRC
-      _registers[reg1] -= src;
-      // Set flags
-      result = dest - src;
+      _alu<OPCODE_SUB>(reg1, _registers[reg1], _registers[reg2]);
       clearFlags = false;
       break;
     case OPCODE_MUL:
       // MUL DEST SRC
-      _registers[reg1] *= src;
-      // Set flags
-      result = dest * src;
+      _alu<OPCODE_MUL>(reg1, _registers[reg1], _registers[reg2]);
       clearFlags = false;
       break;
     case OPCODE_DIV:
       // DIV DEST SRC
-      // Check for divide by zero error, in which case we set the
-      // destination to all ones.
-      if (0 == src) {
-        _registers[reg1] = 0xffff;
-      } else {
-        _registers[reg1] /= src;
-        // Set flags
-        result = dest / src;
-        clearFlags = false;
-      }
+      // Dividing by zero sets the destination to all ones and clears
+      // the flags.
+      _alu<OPCODE_DIV>(reg1, _registers[reg1], _registers[reg2]);
+      clearFlags = false;
       break;
     case OPCODE_AND:
       // AND DEST SRC
-      _registers[reg1] &= src;
-      // Set flags
-      result = dest & src;
+      _alu<OPCODE_AND>(reg1, _registers[reg1], _registers[reg2]);
       clearFlags = false;
       break;
     case OPCODE_OR:
       // OR DEST SRC
-      _registers[reg1] |= src;
-      // Set flags
-      result = dest | src;
+      _alu<OPCODE_OR>(reg1, _registers[reg1], _registers[reg2]);
       clearFlags = false;
       break;
     case OPCODE_XOR:
       // XOR DEST SRC
-      _registers[reg1] ^= src;
-      // Set flags
-      result = dest ^ src;
+      _alu<OPCODE_XOR>(reg1, _registers[reg1], _registers[reg2]);
       clearFlags = false;
       break;
     case OPCODE_SHL:
       // SHL DEST SRC
-      _registers[reg1] <<= src;
-      // Set flags
-      result = dest << src;
+      _alu<OPCODE_SHL>(reg1, _registers[reg1], _registers[reg2]);
       clearFlags = false;
       break;
     case OPCODE_SHRA:
       // SHRA DEST SRC
       // Arithmetic right shift, we have to make sure to sign extend
-      _registers[reg1] = (uint16_t)((int16_t)dest >> src);
-      // Set flags
-      result = (uint32_t)((int32_t)dest >> src);
+      _alu<OPCODE_SHRA>(reg1, _registers[reg1], _registers[reg2]);
       clearFlags = false;
       break;
     case OPCODE_SHRL:
       // SHRL DEST SRC
       // Logical right shift, no sign extend
-      _registers[reg1] >>= src;
-      // Set flags
-      result = dest >> src;
+      _alu<OPCODE_SHRL>(reg1, _registers[reg1], _registers[reg2]);
       clearFlags = false;
       break;
     case OPCODE_CMP:
       // CMP DEST SRC
       // Does DEST - SRC and sets flags.
-      result = dest - src;
+      _alu<OPCODE_CMP>(reg1, _registers[reg1], _registers[reg2]);
       clearFlags = false;
       break;
     case OPCODE_TST:
       // TST DEST SRC
       // Do DEST & SRC and set the flags, but discard the result.
-      result = dest & src;
+      _alu<OPCODE_TST>(reg1, _registers[reg1], _registers[reg2]);
       clearFlags = false;
       break;
     case OPCODE_COLOR:
@@ -284,34 +572,32 @@ void EmuProcessor::execute() {
     case OPCODE_PIXEL:
       // PIXEL X Y
       // Sets the point (X, Y) equal to the value of the color register
-      _window->setPixel(_registers[reg1], _registers[reg2], _colorRegister);
+      _vidMem->set(_registers[reg1], _registers[reg2], _colorRegister);
       break;
     case OPCODE_STOR:
       // STOR DEST SRC
       // DEST is the value you are storing, SRC is the address you
       // are storing it to.
-      _mainMem[src] = dest >> 8;
-      _mainMem[src+1] = dest & 0xff;
+      _store(_registers[reg2], _registers[reg1]);
       break;
     case OPCODE_STORI:
       // STORI DEST ADDR
       // Store the value in DEST to the literal address in main memory.
-      _mainMem[argB] = dest >> 8;
-      _mainMem[argB+1] = dest & 0xff;
+      _store(argB, _registers[reg1]);
       break;
     case OPCODE_TIME:
       // TIME DEST
       // Store the time since last TIMERST (in milliseconds) into DEST
-      _registers[reg1] = ((clock() - timeSinceRst) * 1000) / CLOCKS_PER_SEC;
+      _registers[reg1] = _time(_instructionCount + executed);
       break;
     case OPCODE_TIMERST:
       // Resets the timer to 0
-      timeSinceRst = clock();
+      _resetTimer(_instructionCount + executed);
       break;
     case OPCODE_RND:
       // RND DEST
       // Gets a random 16-bit value and stores it in DEST
-      _registers[reg1] = rand() & 0xffff;
+      _registers[reg1] = _random();
       break;
     case OPCODE_JMP:
       // JMP REG
@@ -325,85 +611,85 @@ void EmuProcessor::execute() {
       break;
     case OPCODE_JEQ:
       // JEQ ADDR
-      if (_zeroFlag) {
+      if (_zeroFlag()) {
         nextInstPtr = argA;
       }
       break;
     case OPCODE_JNE:
       // JNE ADDR
-      if (!_zeroFlag) {
+      if (!_zeroFlag()) {
         nextInstPtr = argA;
       }
       break;
     case OPCODE_JG:
       // JG ADDR
-      if (!_zeroFlag && _signFlag == _overflowFlag) {
+      if (!_zeroFlag() && _signFlag() == _overflowFlag()) {
         nextInstPtr = argA;
       }
       break;
     case OPCODE_JGE:
       // JGE ADDR
-      if (_signFlag == _overflowFlag) {
+      if (_signFlag() == _overflowFlag()) {
         nextInstPtr = argA;
       }
       break;
     case OPCODE_JA:
       // JA ADDR
-      if (!_carryFlag && !_zeroFlag) {
+      if (!_carryFlag() && !_zeroFlag()) {
         nextInstPtr = argA;
       }
       break;
     case OPCODE_JAE:
       // JAE ADDR
-      if (!_carryFlag) {
+      if (!_carryFlag()) {
         nextInstPtr = argA;
       }
       break;
     case OPCODE_JL:
       // JL ADDR
-      if (_signFlag != _overflowFlag) {
+      if (_signFlag() != _overflowFlag()) {
         nextInstPtr = argA;
       }
       break;
     case OPCODE_JLE:
       // JLE ADDR
-      if (_signFlag != _overflowFlag || _zeroFlag) {
+      if (_signFlag() != _overflowFlag() || _zeroFlag()) {
         nextInstPtr = argA;
       }
       break;
     case OPCODE_JB:
       // JB ADDR
-      if (_carryFlag) {
+      if (_carryFlag()) {
         nextInstPtr = argA;
       }
       break;
     case OPCODE_JBE:
       // JBE ADDR
-      if (_carryFlag || _zeroFlag) {
+      if (_carryFlag() || _zeroFlag()) {
         nextInstPtr = argA;
       }
       break;
     case OPCODE_JO:
       // JO ADDR
-      if (_overflowFlag) {
+      if (_overflowFlag()) {
         nextInstPtr = argA;
       }
       break;
     case OPCODE_JNO:
       // JNO ADDR
-      if (!_overflowFlag) {
+      if (!_overflowFlag()) {
         nextInstPtr = argA;
       }
       break;
     case OPCODE_JS:
       // JS ADDR
-      if (_signFlag) {
+      if (_signFlag()) {
         nextInstPtr = argA;
       }
       break;
     case OPCODE_JNS:
       // JNS
-      if (!_signFlag) {
+      if (!_signFlag()) {
         nextInstPtr = argA;
       }
       break;
@@ -411,14 +697,12 @@ void EmuProcessor::execute() {
 
     // Set the instruction pointer to its new position
     _setInstructionPointer(nextInstPtr);
-    // Clear the flags if they were not set somewhere else
+    // Clear the flags if they were not set by the instruction
     if (clearFlags) {
-      _overflowFlag = false;
-      _carryFlag = false;
-      _zeroFlag = false;
-      _signFlag = false;
-    } else {
-      _setFlags(dest, src, result, opcode);
+      _clearFlags();
     }
+    executed++;
   }
+  _instructionCount += executed;
+  return executed;
 }
@@ -8,33 +8,226 @@
 
 #include <unistd.h>
 #include <string>
-#include "window.h"
+#include "io.h"
+#include "isa.h"
+#include "vidmem.h"
 #include "defs.h"
 
+// The interpreter loops available for running instructions
+enum EmuEngine {
+  // Decodes and dispatches each instruction through a switch
+  ENGINE_SWITCH,
+  // Runs predecoded instructions with computed-goto dispatch
+  ENGINE_THREADED,
+  // Compiles basic blocks to x86-64 machine code
+  ENGINE_JIT
+};
+
+// An instruction slot after decoding. The handler is the opcode of
+// the instruction, or OPCODE_DECODE if the slot has been written to
+// since it was last decoded. A fused handler also runs the next slot,
+// whose registers are packed into arg1 or whose target is in argA.
+struct EmuDecodedInst {
+  uint8_t handler;
+  uint8_t reg1;
+  uint8_t reg2;
+  uint8_t arg1;
+  uint16_t argA;
+  uint16_t argB;
+};
+
+// Watches the switch engine run instructions. This one does nothing
+// and compiles away; EmuProfiler has the same interface.
+struct EmuNullObserver {
+  void onInstruction(const uint16_t&) { }
+  void onCall(const uint16_t&) { }
+  void onReturn() { }
+};
+
+class EmuJit;
+class EmuDebugger;
+class EmuRewind;
+class EmuProfiler;
+class EmuTracer;
+class EmuTelemetry;
+
 class EmuProcessor {
+  friend class EmuJit;
+  friend class EmuDebugger;
+  friend class EmuRewind;
+
  public:
-  EmuProcessor(EmuWindow *window, const std::string& infile_name);
+  EmuProcessor(EmuIO *io, const std::string& infile_name);
+  ~EmuProcessor();
   void execute();
+  uint64_t run(const uint64_t& max_instructions);
+  void setEngine(const EmuEngine& engine);
+  // Makes TIME count virtual milliseconds of the given number of
+  // instructions each, instead of real ones, or 0 for real time
+  void setVirtualClock(const uint64_t& instructions_per_milli);
+  // Seeds RND, so that runs that use it can be repeated
+  void setRandomSeed(const uint32_t& seed) { _randomState = seed | 1; }
+  bool saveState(const std::string& state_filename);
+  bool loadState(const std::string& state_filename);
+  // Profiling runs everything on the switch engine
+  void setProfiler(EmuProfiler *profiler) { _profiler = profiler; }
+  // Tracing runs everything on the threaded engine, from the current
+  // state, without fused instructions
+  void setTracer(EmuTracer *tracer);
+  // Debugging runs everything on the threaded engine, with
+  // breakpoints in the predecoded slots
+  void setDebugger(EmuDebugger *debugger);
+  // Rewinding takes checkpoints between the slices of execute(), and
+  // steps back through them when asked to
+  void setRewind(EmuRewind *rewind);
+  // Telemetry hears about the instructions run after every slice
+  void setTelemetry(EmuTelemetry *telemetry) { _telemetry = telemetry; }
+  // The rate for execute() to run at in MHz, or 0 for no limit
+  void setTargetRate(const double& mhz) { _targetMhz = mhz; }
+  double getTargetRate() { return _targetMhz; }
+  // Whether execute() sleeps through loops that only wait on TIME or
+  // INPUT, rather than spinning. Only the real clock can be slept on.
+  void setIdleSleep(bool idle_sleep) { _idleSleep = idle_sleep; }
+  uint64_t getParkCount() { return _parkCount; }
+  uint64_t getParkedMillis() { return _parkedNanos / 1000000; }
+  double getAchievedRate() { return _achievedMhz; }
+  uint64_t getInstructionCount() { return _instructionCount; }
+  // Instructions the threaded engine ran, and how many of them ran
+  // as part of a fused pair
+  uint64_t getThreadedCount() { return _threadedCount; }
+  uint64_t getFusedCount() { return _fusedCount; }
   bool hasError() { return _error; }
   void setRunning(bool running) { _running = running; }
+  bool isRunning() { return _running; }
 
  private:
-  void _push(const uint16_t& val);
+  uint16_t _load(const uint16_t& addr) {
+    return (_mainMem[addr] << 8) | _mainMem[(uint16_t)(addr + 1)];
+  }
+  void _store(const uint16_t& addr, const uint16_t& val) {
+    uint16_t next = addr + 1;
+    _mainMem[addr] = val >> 8;
+    _mainMem[next] = val & 0xff;
+    // Force the instruction slots that were written to be decoded
+    // again, so that self-modifying code still works. The slot before
+    // them may have been fused with the first, so it goes too.
+    _decoded[(uint16_t)(addr - INST_SIZE) / INST_SIZE].handler =
+      OPCODE_DECODE;
+    _decoded[addr / INST_SIZE].handler = OPCODE_DECODE;
+    _decoded[next / INST_SIZE].handler = OPCODE_DECODE;
+    if (_pageFlags[addr / MEMORY_PAGE_SIZE] |
+        _pageFlags[next / MEMORY_PAGE_SIZE]) {
+      _storeHook(addr);
+    }
+  }
+  uint16_t _random() {
+    // A xorshift generator per processor, so that processors on
+    // different threads do not share the state of rand()
+    _randomState ^= _randomState << 13;
+    _randomState ^= _randomState >> 17;
+    _randomState ^= _randomState << 5;
+    return _randomState >> 16;
+  }
+  uint64_t _timeNow(const uint64_t& instruction_count);
+  uint64_t _timeUnitsPerMilli();
+  uint16_t _time(const uint64_t& instruction_count);
+  void _resetTimer(const uint64_t& instruction_count);
+  void _storeHook(const uint16_t& addr);
+  void _push(uint16_t val);
   uint16_t _pop();
+  void _decode(const uint16_t& slot);
+  void _step();
+  template <class Observer>
+  uint64_t _runSwitch(const uint64_t& max_instructions, Observer& observer);
+  template <bool Traced>
+  uint64_t _runThreaded(const uint64_t& max_instructions);
   void _setInstructionPointer(const uint16_t& ip);
+  bool _idleLoop(const uint16_t& ip);
+  void _park(const uint32_t& input_generation);
+  bool _condition(const uint8_t& opcode);
+  // The flags are evaluated lazily from a record of the last ALU
+  // instruction, since most of them are never read
   void _setFlags(const uint32_t& dest,
                  const uint32_t& src,
                  const uint32_t& result,
-                 const uint8_t& opcode);
-  EmuWindow *_window;
+                 const uint8_t& opcode) {
+    _flagOpcode = opcode;
+    _flagDest = dest;
+    _flagSrc = src;
+    _flagResult = result;
+  }
+  void _clearFlags() {
+    // A result of 1 with no ALU opcode has every flag unset
+    _flagOpcode = OPCODE_NOP;
+    _flagResult = 1;
+  }
+  // Runs an instruction that sets the flags, given the values of its
+  // registers. Everything that depends on the opcode is settled when
+  // the handler for it is compiled.
+  template <uint8_t Opcode>
+  void _alu(const uint8_t& reg1, const uint32_t& dest, const uint32_t& src) {
+    if (OPCODE_DIV == Opcode && 0 == src) {
+      // Divide by zero sets the destination to all ones
+      _registers[reg1] = 0xffff;
+      _clearFlags();
+      return;
+    }
+    if (ISA_WRITES_REG1 == EMU_ISA[Opcode].writes) {
+      _registers[reg1] = emuValue<Opcode>(dest, src);
+    }
+    _setFlags(dest, src, emuResult<Opcode>(dest, src), Opcode);
+  }
+  bool _overflowFlag() {
+    switch (EMU_ISA[_flagOpcode].overflow) {
+    case OVERFLOW_ADD:
+      return 0x8000 & (_flagDest ^ _flagResult) & (_flagSrc ^ _flagResult);
+    case OVERFLOW_SUB:
+      return 0x8000 & (_flagDest ^ _flagSrc) & (_flagDest ^ _flagResult);
+    default:
+      return false;
+    }
+  }
+  // Carry set if the result is too large to fit into 16 bits
+  bool _carryFlag() { return 0xffff < _flagResult; }
+  // Zero set if the result was zero
+  bool _zeroFlag() { return !(0xffff & _flagResult); }
+  // Sign flag set if the sign bit of the result is set
+  bool _signFlag() { return 0x8000 & _flagResult; }
+  EmuIO *_io;
+  EmuVideoMemory *_vidMem;
+  EmuEngine _engine;
   uint8_t _mainMem[MAIN_MEMORY_SIZE];
+  EmuDecodedInst _decoded[MAIN_MEMORY_SIZE / INST_SIZE];
+  uint8_t _pageFlags[MAIN_MEMORY_SIZE / MEMORY_PAGE_SIZE];
+  EmuJit *_jit;
+  EmuProfiler *_profiler;
+  EmuTracer *_tracer;
+  EmuDebugger *_debugger;
+  EmuRewind *_rewind;
+  EmuTelemetry *_telemetry;
   uint16_t _registers[NUM_REGISTERS];
   uint16_t _instructionPointer;
   uint8_t _colorRegister;
-  bool _overflowFlag;
-  bool _carryFlag;
-  bool _zeroFlag;
-  bool _signFlag;
+  // The last ALU instruction to set the flags, or OPCODE_NOP
+  uint8_t _flagOpcode;
+  uint32_t _flagDest;
+  uint32_t _flagSrc;
+  uint32_t _flagResult;
+  // The value of the time base at the last time we encountered
+  // a TIMERST instruction, and the instructions per virtual
+  // millisecond, or 0 if the time base is the real clock.
+  uint64_t _timerReset;
+  uint64_t _virtualClock;
+  uint32_t _randomState;
+  uint64_t _instructionCount;
+  uint64_t _threadedCount;
+  uint64_t _fusedCount;
+  double _targetMhz;
+  double _achievedMhz;
+  // How many times execute() slept in an idle loop, and for how long
+  bool _idleSleep;
+  uint64_t _parkCount;
+  uint64_t _parkedNanos;
   bool _error;
   bool _running;
 };
@@ -0,0 +1,169 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string.h>
+#include "profiler.h"
+
+EmuProfiler::EmuProfiler() : _current(0), _depth(0), _lostDepth(0) {
+  // The root of the call tree is whatever runs outside of any call
+  Node root = { 0, 0, 0 };
+  _nodes.push_back(root);
+  memset(_counts, 0, sizeof(_counts));
+}
+
+void EmuProfiler::onCall(const uint16_t& target) {
+  if (PROFILE_MAX_DEPTH <= _depth) {
+    // Runaway recursion, don't grow the tree any further
+    _lostDepth++;
+    return;
+  }
+  uint64_t key = ((uint64_t)_current << 16) | target;
+  auto child = _children.find(key);
+  if (_children.end() == child) {
+    Node node = { target, _current, 0 };
+    _nodes.push_back(node);
+    child = _children.insert(std::make_pair(key, _nodes.size() - 1)).first;
+  }
+  _current = child->second;
+  _depth++;
+}
+
+void EmuProfiler::onReturn() {
+  // A return without a matching call stays at the root
+  if (0 < _lostDepth) {
+    _lostDepth--;
+  } else if (0 < _depth) {
+    _current = _nodes[_current].parent;
+    _depth--;
+  }
+}
+
+std::string EmuProfiler::_nodeName(const uint32_t& node) {
+  if (0 == node) {
+    return "entry";
+  }
+  std::ostringstream name;
+  name << "0x" << std::hex << std::setw(4) << std::setfill('0')
+       << _nodes[node].function;
+  return name.str();
+}
+
+void EmuProfiler::report(std::ostream& out) {
+  // Children are always created after their parents, so walking the
+  // tree backwards totals every subtree before its parent needs it
+  std::vector<uint64_t> inclusive(_nodes.size());
+  for (size_t i = _nodes.size(); i-- > 0; ) {
+    inclusive[i] += _nodes[i].self;
+    if (0 != i) {
+      inclusive[_nodes[i].parent] += inclusive[i];
+    }
+  }
+  uint64_t total = inclusive[0];
+  if (0 == total) {
+    return;
+  }
+
+  // Total the nodes of each function. A recursive function would be
+  // counted more than once, so its inclusive count only comes from
+  // the outermost calls to it.
+  struct Function {
+    std::string name;
+    uint64_t inclusive;
+    uint64_t exclusive;
+  };
+  std::vector<Function> functions;
+  std::unordered_map<std::string, size_t> functionIndex;
+  for (uint32_t i = 0; i < _nodes.size(); i++) {
+    std::string name = _nodeName(i);
+    auto index = functionIndex.find(name);
+    if (functionIndex.end() == index) {
+      Function function = { name, 0, 0 };
+      functions.push_back(function);
+      index = functionIndex.insert(
+        std::make_pair(name, functions.size() - 1)).first;
+    }
+    Function& function = functions[index->second];
+    function.exclusive += _nodes[i].self;
+    bool outermost = true;
+    for (uint32_t j = i; 0 != j && outermost; ) {
+      j = _nodes[j].parent;
+      outermost = 0 == j || _nodes[j].function != _nodes[i].function;
+    }
+    if (outermost) {
+      function.inclusive += inclusive[i];
+    }
+  }
+  std::sort(functions.begin(), functions.end(),
+            [](const Function& a, const Function& b) {
+              return a.inclusive > b.inclusive;
+            });
+
+  std::vector<uint16_t> addresses;
+  for (int slot = 0; slot < MAIN_MEMORY_SIZE / INST_SIZE; slot++) {
+    if (0 != _counts[slot]) {
+      addresses.push_back(slot);
+    }
+  }
+  std::sort(addresses.begin(), addresses.end(),
+            [this](const uint16_t& a, const uint16_t& b) {
+              return _counts[a] > _counts[b];
+            });
+
+  out << "Profile of " << total << " instructions" << std::endl
+      << "Function    Inclusive           Exclusive" << std::endl
+      << std::fixed << std::setprecision(1) << std::setfill(' ');
+  for (size_t i = 0; i < functions.size() && i < PROFILE_REPORT_ROWS; i++) {
+    const Function& function = functions[i];
+    out << std::left << std::setw(8) << function.name << std::right
+        << std::setw(14) << function.inclusive << " "
+        << std::setw(5) << 100.0 * function.inclusive / total << "%"
+        << std::setw(14) << function.exclusive << " "
+        << std::setw(5) << 100.0 * function.exclusive / total << "%"
+        << std::endl;
+  }
+  out << "Address     Count" << std::endl;
+  for (size_t i = 0; i < addresses.size() && i < PROFILE_REPORT_ROWS; i++) {
+    uint64_t count = _counts[addresses[i]];
+    out << "0x" << std::hex << std::setw(4) << std::setfill('0')
+        << addresses[i] * INST_SIZE << std::dec << std::setfill(' ')
+        << std::setw(16) << count << " "
+        << std::setw(5) << 100.0 * count / total << "%" << std::endl;
+  }
+  out.unsetf(std::ios_base::floatfield);
+  out << std::setprecision(6);
+}
+
+bool EmuProfiler::writeFoldedStacks(const std::string& filename) {
+  // One line per call stack, with the frames from the outermost in
+  // separated by semicolons and followed by the instructions run
+  // directly in it. This is the input format of flamegraph tools.
+  std::ofstream file(filename);
+  if (!file.good()) {
+    std::cerr << "Error: Failed to open profile file '"
+              << filename << "'." << std::endl;
+    return false;
+  }
+  std::vector<uint32_t> stack;
+  for (uint32_t i = 0; i < _nodes.size(); i++) {
+    if (0 == _nodes[i].self) {
+      continue;
+    }
+    stack.clear();
+    for (uint32_t j = i; 0 != j; j = _nodes[j].parent) {
+      stack.push_back(j);
+    }
+    file << _nodeName(0);
+    for (size_t k = stack.size(); k-- > 0; ) {
+      file << ";" << _nodeName(stack[k]);
+    }
+    file << " " << _nodes[i].self << std::endl;
+  }
+  return file.good();
+}
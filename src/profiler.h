@@ -0,0 +1,52 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#ifndef EMU_PROFILER_H
+#define EMU_PROFILER_H
+
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "defs.h"
+
+// Counts how many times each instruction runs, and follows CALL and
+// RET to attribute every instruction to the call stack it ran under.
+// The processor only reports to a profiler from the switch engine,
+// which is built separately for profiling so that it costs nothing
+// otherwise.
+class EmuProfiler {
+ public:
+  EmuProfiler();
+  void onInstruction(const uint16_t& ip) {
+    _counts[ip / INST_SIZE]++;
+    _nodes[_current].self++;
+  }
+  void onCall(const uint16_t& target);
+  void onReturn();
+  void report(std::ostream& out);
+  bool writeFoldedStacks(const std::string& filename);
+
+ private:
+  // A node of the call tree, one for every distinct call stack
+  struct Node {
+    uint16_t function;
+    uint32_t parent;
+    uint64_t self;
+  };
+  std::string _nodeName(const uint32_t& node);
+
+  std::vector<Node> _nodes;
+  // Maps a parent node and called function to the child node
+  std::unordered_map<uint64_t, uint32_t> _children;
+  uint32_t _current;
+  uint32_t _depth;
+  // Calls made past PROFILE_MAX_DEPTH, which stay in the deepest node
+  uint32_t _lostDepth;
+  uint64_t _counts[MAIN_MEMORY_SIZE / INST_SIZE];
+};
+
+#endif
@@ -0,0 +1,195 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string.h>
+#include "recorder.h"
+#include "vidmem.h"
+
+EmuRecorder::EmuRecorder(const std::string& record_filename,
+                         const double& frame_rate)
+                        : _filename(record_filename),
+                          _fd(-1),
+                          _y4m(false),
+                          _error(false),
+                          _slots(nullptr),
+                          _head(0),
+                          _tail(0),
+                          _stopping(false),
+                          _writeFailed(false),
+                          _pushed(0),
+                          _dropped(0),
+                          _written(0) {
+  _fd = open(record_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (-1 == _fd) {
+    std::cerr << "Error: Failed to open recording '"
+              << record_filename << "'." << std::endl;
+    _error = true;
+    return;
+  }
+  const std::string ext = ".y4m";
+  _y4m = ext.size() < record_filename.size() &&
+         0 == record_filename.compare(record_filename.size() - ext.size(),
+                                      ext.size(), ext);
+
+  // Work out what every color becomes in the file once, so that the
+  // writer only has to look colors up. YUV is BT.601 in studio range.
+  for (int color = 0; color < 256; color++) {
+    uint32_t rgb = EmuVideoMemory::toRGB(color);
+    double r = (rgb >> 16) & 0xff;
+    double g = (rgb >> 8) & 0xff;
+    double b = rgb & 0xff;
+    if (_y4m) {
+      _palette[color][0] = lround(16 + (65.481 * r + 128.553 * g +
+                                        24.966 * b) / 255);
+      _palette[color][1] = lround(128 + (-37.797 * r - 74.203 * g +
+                                         112.0 * b) / 255);
+      _palette[color][2] = lround(128 + (112.0 * r - 93.786 * g -
+                                         18.214 * b) / 255);
+    } else {
+      _palette[color][0] = r;
+      _palette[color][1] = g;
+      _palette[color][2] = b;
+    }
+  }
+  _frameBytes = VIDEO_MEMORY_SIZE * 3;
+  _buffer.reserve(RECORD_BUFFER_FRAMES * (_frameBytes + 6));
+  if (_y4m) {
+    // The frame rate is a ratio, in thousandths for fractional rates
+    std::ostringstream header;
+    header << "YUV4MPEG2 W" << VIDEO_WIDTH << " H" << VIDEO_HEIGHT << " F";
+    if (frame_rate == floor(frame_rate)) {
+      header << (long)frame_rate << ":1";
+    } else {
+      header << lround(frame_rate * 1000) << ":1000";
+    }
+    header << " Ip A1:1 C444\n";
+    std::string str = header.str();
+    _buffer.insert(_buffer.end(), str.begin(), str.end());
+  }
+
+  _slots = new uint8_t[RECORD_QUEUE_FRAMES * VIDEO_MEMORY_SIZE];
+  _writer = std::thread(&EmuRecorder::_writerLoop, this);
+}
+
+EmuRecorder::~EmuRecorder() {
+  stop();
+  delete[] _slots;
+}
+
+void EmuRecorder::pushFrame(const uint8_t *frame) {
+  // Only the presenter moves the head, and only the writer the tail
+  uint32_t head = _head.load(std::memory_order_relaxed);
+  uint32_t tail = _tail.load(std::memory_order_acquire);
+  _pushed++;
+  if (RECORD_QUEUE_FRAMES == head - tail) {
+    // The writer has fallen behind, so skip the frame rather than wait
+    _dropped++;
+    return;
+  }
+  memcpy(&_slots[(head % RECORD_QUEUE_FRAMES) * VIDEO_MEMORY_SIZE], frame,
+         VIDEO_MEMORY_SIZE);
+  _head.store(head + 1, std::memory_order_release);
+}
+
+bool EmuRecorder::stop() {
+  if (_writer.joinable()) {
+    _stopping.store(true, std::memory_order_release);
+    _writer.join();
+  }
+  if (-1 != _fd) {
+    if (0 != close(_fd)) {
+      _writeFailed = true;
+    }
+    _fd = -1;
+    if (_writeFailed) {
+      std::cerr << "Error: Failed to write recording '"
+                << _filename << "'." << std::endl;
+    }
+  }
+  return !_error && !_writeFailed;
+}
+
+void EmuRecorder::report(std::ostream& out) {
+  out << "Record: " << _written << " frames written, " << _dropped
+      << " of " << _pushed << " dropped" << std::endl;
+}
+
+void EmuRecorder::_writerLoop() {
+  while (true) {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _head.load(std::memory_order_acquire)) {
+      // Nothing is queued. Once the presenter is done pushing frames,
+      // that means the recording is finished.
+      if (_stopping.load(std::memory_order_acquire) &&
+          tail == _head.load(std::memory_order_acquire)) {
+        break;
+      }
+      std::this_thread::sleep_for(
+        std::chrono::microseconds(RECORD_IDLE_MICROS));
+      continue;
+    }
+    _convert(&_slots[(tail % RECORD_QUEUE_FRAMES) * VIDEO_MEMORY_SIZE]);
+    _tail.store(tail + 1, std::memory_order_release);
+    _written++;
+    if (_buffer.size() + _frameBytes + 6 > _buffer.capacity()) {
+      _flush();
+    }
+  }
+  _flush();
+}
+
+void EmuRecorder::_convert(const uint8_t *frame) {
+  // Append the frame to the buffer, as planes for Y4M and as packed
+  // pixels for raw RGB
+  size_t start = _buffer.size();
+  if (_y4m) {
+    const char tag[] = "FRAME\n";
+    _buffer.insert(_buffer.end(), tag, tag + sizeof(tag) - 1);
+    start = _buffer.size();
+    _buffer.resize(start + _frameBytes);
+    uint8_t *planes[3] = {
+      &_buffer[start],
+      &_buffer[start + VIDEO_MEMORY_SIZE],
+      &_buffer[start + 2 * VIDEO_MEMORY_SIZE]
+    };
+    for (int i = 0; i < VIDEO_MEMORY_SIZE; i++) {
+      const uint8_t *yuv = _palette[frame[i]];
+      planes[0][i] = yuv[0];
+      planes[1][i] = yuv[1];
+      planes[2][i] = yuv[2];
+    }
+  } else {
+    _buffer.resize(start + _frameBytes);
+    uint8_t *dest = &_buffer[start];
+    for (int i = 0; i < VIDEO_MEMORY_SIZE; i++) {
+      memcpy(dest + (i * 3), _palette[frame[i]], 3);
+    }
+  }
+}
+
+bool EmuRecorder::_flush() {
+  // Once a write has failed, frames are still taken off the queue so
+  // the presenter never backs up, but they go nowhere
+  size_t done = 0;
+  while (!_writeFailed && done < _buffer.size()) {
+    ssize_t n = write(_fd, &_buffer[done], _buffer.size() - done);
+    if (n < 0 && EINTR == errno) {
+      continue;
+    } else if (n < 0) {
+      _writeFailed = true;
+      break;
+    }
+    done += n;
+  }
+  _buffer.clear();
+  return !_writeFailed;
+}
@@ -0,0 +1,66 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#ifndef EMU_RECORDER_H
+#define EMU_RECORDER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "defs.h"
+
+// Records presented frames to a video file. The presenter copies each
+// frame into a fixed ring of slots that a writer thread drains, with
+// only an atomic index on each side, so the presenter never waits on
+// the disk; when the ring is full the frame is dropped and counted.
+// Files ending in ".y4m" are written as YUV4MPEG2 (4:4:4), anything
+// else as raw 24-bit RGB.
+class EmuRecorder {
+ public:
+  EmuRecorder(const std::string& record_filename, const double& frame_rate);
+  ~EmuRecorder();
+  bool hasError() { return _error; }
+  // Presenter side
+  void pushFrame(const uint8_t *frame);
+  // Waits for the writer to write out every queued frame, and returns
+  // whether the whole recording made it to the file
+  bool stop();
+  void report(std::ostream& out);
+
+ private:
+  void _writerLoop();
+  void _convert(const uint8_t *frame);
+  bool _flush();
+
+  std::string _filename;
+  int _fd;
+  bool _y4m;
+  bool _error;
+  // Bytes of one frame in the file, and frames collected in _buffer
+  // before each write to it
+  size_t _frameBytes;
+  std::vector<uint8_t> _buffer;
+  // The output bytes for each 3-3-2 color, RGB or YUV
+  uint8_t _palette[256][3];
+  uint8_t *_slots;
+  // Frames pushed by the presenter and taken by the writer, padded
+  // onto cache lines of their own so the two threads don't fight
+  // over them
+  std::atomic<uint32_t> _head;
+  uint8_t _headPadding[CACHE_LINE_SIZE];
+  std::atomic<uint32_t> _tail;
+  uint8_t _tailPadding[CACHE_LINE_SIZE];
+  std::atomic<bool> _stopping;
+  std::atomic<bool> _writeFailed;
+  uint64_t _pushed;
+  uint64_t _dropped;
+  uint64_t _written;
+  std::thread _writer;
+};
+
+#endif
@@ -0,0 +1,288 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#include <chrono>
+#include <thread>
+#include <string.h>
+#include "rewind.h"
+#include "processor.h"
+#include "jit.h"
+
+static bool is_set(const uint8_t *bits, const int& i) {
+  return bits[i / 8] & (1 << (i % 8));
+}
+
+static uint64_t steady_nanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+EmuRewind::EmuRewind(const size_t& buffer_bytes)
+                     : _processor(nullptr),
+                       _ring(buffer_bytes),
+                       _head(0),
+                       _rowGeneration(0),
+                       _due(0),
+                       _atCheckpoint(false),
+                       _waiting(false),
+                       _timerElapsed(0),
+                       _requested(0),
+                       _held(false),
+                       _checkpointCount(0),
+                       _keyframeCount(0),
+                       _checkpointBytes(0),
+                       _checkpointNanos(0),
+                       _checkpointMaxNanos(0),
+                       _stepCount(0),
+                       _startNanos(0) {
+  memset(_video, 0, sizeof(_video));
+}
+
+void EmuRewind::attach(EmuProcessor *processor) {
+  // The first checkpoint is a keyframe taken before anything runs
+  _processor = processor;
+  _startDelta();
+  _due = _now();
+  _startNanos = steady_nanos();
+}
+
+uint64_t EmuRewind::_now() {
+  return _processor->_timeNow(_processor->_instructionCount);
+}
+
+void EmuRewind::_setTimer(const uint64_t& elapsed) {
+  _processor->_timerReset = _now() - elapsed;
+}
+
+void EmuRewind::_startDelta() {
+  // Everything from here on counts as written since the checkpoint
+  for (int page = 0; page < MAIN_MEMORY_SIZE / MEMORY_PAGE_SIZE; page++) {
+    _processor->_pageFlags[page] |= PAGE_FLAG_REWIND;
+  }
+  _rowGeneration = _processor->_vidMem->mark();
+}
+
+bool EmuRewind::update() {
+  for (uint32_t steps = _requested.exchange(0, std::memory_order_relaxed);
+       0 < steps; steps--) {
+    _restore();
+  }
+  if (_held.load(std::memory_order_relaxed)) {
+    // Stay on the checkpoint stepped back to, with TIME stopped
+    _waiting = true;
+    std::this_thread::sleep_for(
+      std::chrono::microseconds(REWIND_WAIT_MICROS));
+    return false;
+  }
+  uint64_t interval = _processor->_timeUnitsPerMilli() * 1000 / REWIND_FRAMES;
+  if (_waiting) {
+    _waiting = false;
+    _setTimer(_timerElapsed);
+    _due = _now() + interval;
+  }
+  if (_due <= _now()) {
+    // Count the checkpoints since the last keyframe
+    size_t deltas = 0;
+    for (auto it = _entries.rbegin();
+         _entries.rend() != it && !it->keyframe; ++it) {
+      deltas++;
+    }
+    _checkpoint(_entries.empty() || REWIND_KEYFRAME_INTERVAL <= deltas + 1);
+    _due = _now() + interval;
+  }
+  _atCheckpoint = false;
+  return true;
+}
+
+size_t EmuRewind::_allocate(const size_t& size) {
+  // The ring holds the checkpoints in order from the front entry
+  // round to the head, so the ones in the way of the new one are
+  // always the oldest
+  if (_ring.size() < _head + size) {
+    while (!_entries.empty() && _head <= _entries.front().offset) {
+      _entries.pop_front();
+    }
+    _head = 0;
+  }
+  while (!_entries.empty() && _head <= _entries.front().offset &&
+         _entries.front().offset < _head + size) {
+    _entries.pop_front();
+  }
+  // Checkpoints after a keyframe that was lost can't be put back
+  // together any more
+  while (!_entries.empty() && !_entries.front().keyframe) {
+    _entries.pop_front();
+  }
+  size_t offset = _head;
+  _head += size;
+  return offset;
+}
+
+void EmuRewind::_checkpoint(const bool& keyframe) {
+  uint64_t start = steady_nanos();
+  EmuProcessor *p = _processor;
+  EmuRewindHeader header;
+  memset(&header, 0, sizeof(header));
+  bool full = keyframe;
+  size_t size, offset;
+  while (true) {
+    size = sizeof(header);
+    for (int page = 0; page < MAIN_MEMORY_SIZE / MEMORY_PAGE_SIZE; page++) {
+      if (full || !(p->_pageFlags[page] & PAGE_FLAG_REWIND)) {
+        header.pages[page / 8] |= 1 << (page % 8);
+        size += MEMORY_PAGE_SIZE;
+      }
+    }
+    for (int y = 0; y < VIDEO_HEIGHT; y++) {
+      if (full || _rowGeneration <= p->_vidMem->getRowStamp(y)) {
+        header.rows[y / 8] |= 1 << (y % 8);
+        size += VIDEO_WIDTH;
+      }
+    }
+    offset = _allocate(size);
+    // If making room lost every checkpoint, there is nothing for this
+    // one to follow, so it has to hold everything
+    if (full || !_entries.empty()) {
+      break;
+    }
+    _head = offset;
+    full = true;
+  }
+
+  memcpy(header.registers, p->_registers, sizeof(header.registers));
+  header.instructionPointer = p->_instructionPointer;
+  header.colorRegister = p->_colorRegister;
+  header.flagOpcode = p->_flagOpcode;
+  header.flagDest = p->_flagDest;
+  header.flagSrc = p->_flagSrc;
+  header.flagResult = p->_flagResult;
+  header.randomState = p->_randomState;
+  header.timerElapsed = _now() - p->_timerReset;
+  uint8_t *out = &_ring[offset];
+  memcpy(out, &header, sizeof(header));
+  out += sizeof(header);
+  for (int page = 0; page < MAIN_MEMORY_SIZE / MEMORY_PAGE_SIZE; page++) {
+    if (is_set(header.pages, page)) {
+      memcpy(out, &p->_mainMem[page * MEMORY_PAGE_SIZE], MEMORY_PAGE_SIZE);
+      out += MEMORY_PAGE_SIZE;
+    }
+  }
+  const uint8_t *video = p->_vidMem->getData();
+  for (int y = 0; y < VIDEO_HEIGHT; y++) {
+    if (is_set(header.rows, y)) {
+      memcpy(out, video + (y * VIDEO_WIDTH), VIDEO_WIDTH);
+      out += VIDEO_WIDTH;
+    }
+  }
+  Entry entry;
+  entry.offset = offset;
+  entry.size = size;
+  entry.keyframe = full;
+  _entries.push_back(entry);
+  _startDelta();
+
+  uint64_t nanos = steady_nanos() - start;
+  _checkpointCount++;
+  _keyframeCount += full ? 1 : 0;
+  _checkpointBytes += size;
+  _checkpointNanos += nanos;
+  if (_checkpointMaxNanos < nanos) {
+    _checkpointMaxNanos = nanos;
+  }
+}
+
+void EmuRewind::_restore() {
+  // Step back to the newest checkpoint, or the one before it if
+  // nothing has run since
+  if (_entries.empty()) {
+    return;
+  }
+  if (_atCheckpoint && 1 < _entries.size()) {
+    _head = _entries.back().offset;
+    _entries.pop_back();
+  }
+
+  // Put memory back together from the keyframe before, applying every
+  // checkpoint since in order
+  EmuProcessor *p = _processor;
+  size_t first = _entries.size() - 1;
+  while (!_entries[first].keyframe) {
+    first--;
+  }
+  EmuRewindHeader header;
+  for (size_t i = first; i < _entries.size(); i++) {
+    const uint8_t *in = &_ring[_entries[i].offset];
+    memcpy(&header, in, sizeof(header));
+    in += sizeof(header);
+    for (int page = 0; page < MAIN_MEMORY_SIZE / MEMORY_PAGE_SIZE; page++) {
+      if (is_set(header.pages, page)) {
+        memcpy(&p->_mainMem[page * MEMORY_PAGE_SIZE], in, MEMORY_PAGE_SIZE);
+        in += MEMORY_PAGE_SIZE;
+      }
+    }
+    for (int y = 0; y < VIDEO_HEIGHT; y++) {
+      if (is_set(header.rows, y)) {
+        memcpy(_video + (y * VIDEO_WIDTH), in, VIDEO_WIDTH);
+        in += VIDEO_WIDTH;
+      }
+    }
+  }
+  p->_vidMem->loadState(_video);
+  memcpy(p->_registers, header.registers, sizeof(header.registers));
+  p->_setInstructionPointer(header.instructionPointer);
+  p->_colorRegister = header.colorRegister;
+  p->_flagOpcode = header.flagOpcode;
+  p->_flagDest = header.flagDest;
+  p->_flagSrc = header.flagSrc;
+  p->_flagResult = header.flagResult;
+  p->_randomState = header.randomState;
+  // The instruction count carries on, since it counts what ran
+  _timerElapsed = header.timerElapsed;
+  _setTimer(_timerElapsed);
+  _due = _now() + _processor->_timeUnitsPerMilli() * 1000 / REWIND_FRAMES;
+
+  // Nothing decoded or compiled from memory as it was can be trusted
+  for (int slot = 0; slot < MAIN_MEMORY_SIZE / INST_SIZE; slot++) {
+    p->_decoded[slot].handler = OPCODE_DECODE;
+  }
+  if (nullptr != p->_jit) {
+    p->_jit->flush();
+  }
+  _startDelta();
+  p->_vidMem->publishIfRequested();
+  _atCheckpoint = true;
+  _stepCount++;
+}
+
+void EmuRewind::report(std::ostream& out) {
+  // How much history the ring holds now, what a second of it costs on
+  // average, next to copying all of memory every checkpoint, and how
+  // long the processor spent taking checkpoints
+  size_t used = 0;
+  for (const Entry& entry : _entries) {
+    used += entry.size;
+  }
+  out << "Rewind: " << _checkpointCount << " checkpoints ("
+      << _keyframeCount << " keyframes), " << _stepCount
+      << " steps back" << std::endl;
+  out << "Rewind history: " << (double)_entries.size() / REWIND_FRAMES
+      << " s in " << used / 1024 << " KiB of " << _ring.size() / 1024
+      << " KiB";
+  if (0 < _checkpointCount) {
+    out << ", " << _checkpointBytes * REWIND_FRAMES / _checkpointCount / 1024
+        << " KiB per second vs "
+        << (uint64_t)(MAIN_MEMORY_SIZE + VIDEO_MEMORY_SIZE) *
+           REWIND_FRAMES / 1024
+        << " KiB for full copies";
+  }
+  out << std::endl;
+  if (0 < _checkpointCount) {
+    uint64_t elapsed = steady_nanos() - _startNanos;
+    out << "Rewind overhead: " << _checkpointNanos / _checkpointCount / 1000.0
+        << "us average, " << _checkpointMaxNanos / 1000.0 << "us max, "
+        << (0 < elapsed ? 100.0 * _checkpointNanos / elapsed : 0)
+        << "% of the run" << std::endl;
+  }
+}
@@ -0,0 +1,110 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#ifndef EMU_REWIND_H
+#define EMU_REWIND_H
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <ostream>
+#include <vector>
+#include "defs.h"
+
+class EmuProcessor;
+
+// The start of every checkpoint in the ring, followed by the contents
+// of each page of main memory and each row of video memory it marks
+struct EmuRewindHeader {
+  uint8_t pages[MAIN_MEMORY_SIZE / MEMORY_PAGE_SIZE / 8];
+  uint8_t rows[VIDEO_HEIGHT / 8];
+  uint16_t registers[NUM_REGISTERS];
+  uint16_t instructionPointer;
+  uint8_t colorRegister;
+  uint8_t flagOpcode;
+  uint32_t flagDest;
+  uint32_t flagSrc;
+  uint32_t flagResult;
+  uint32_t randomState;
+  // The time since the last TIMERST, in units of the time base
+  uint64_t timerElapsed;
+};
+
+// Keeps the last few seconds of a run so that they can be stepped back
+// through, a frame at a time. Checkpoints are taken REWIND_FRAMES a
+// second of TIME, and hold only the pages of main memory and rows of
+// video memory written since the one before, along with the registers
+// and flags. Every REWIND_KEYFRAME_INTERVAL checkpoints one holds
+// everything, and stepping back starts from the keyframe before and
+// applies the checkpoints after it. They all go into a ring of a fixed
+// size, which loses the oldest second or so at a time when it fills.
+//
+// Pages that haven't been written since the last checkpoint have
+// PAGE_FLAG_REWIND set, so the first store to each one goes through
+// the store hook, which clears it; the rest cost nothing. Rows come
+// from the generation that video memory stamps them with.
+class EmuRewind {
+ public:
+  EmuRewind(const size_t& buffer_bytes);
+
+  // Window side. Each press steps back a frame, and the processor
+  // stays on it until the key is let go.
+  void press() {
+    _requested.fetch_add(1, std::memory_order_relaxed);
+    _held.store(true, std::memory_order_relaxed);
+  }
+  void release() { _held.store(false, std::memory_order_relaxed); }
+
+  // Processor side
+  void attach(EmuProcessor *processor);
+  // Takes a checkpoint if one is due and steps back if asked to,
+  // between slices. Returns false while the processor should wait.
+  bool update();
+  void report(std::ostream& out);
+
+ private:
+  // Where a checkpoint is in the ring
+  struct Entry {
+    size_t offset;
+    size_t size;
+    bool keyframe;
+  };
+  void _checkpoint(const bool& keyframe);
+  void _restore();
+  size_t _allocate(const size_t& size);
+  void _startDelta();
+  void _setTimer(const uint64_t& elapsed);
+  uint64_t _now();
+
+  EmuProcessor *_processor;
+  std::vector<uint8_t> _ring;
+  std::deque<Entry> _entries;
+  // Where the next checkpoint goes in the ring
+  size_t _head;
+  // The first video memory generation of rows written since the last
+  // checkpoint, and when the next checkpoint is due
+  uint32_t _rowGeneration;
+  uint64_t _due;
+  // Whether nothing has run since the newest checkpoint, so stepping
+  // back goes to the one before it, and the time since the last
+  // TIMERST to carry on from when it stops waiting
+  bool _atCheckpoint;
+  bool _waiting;
+  uint64_t _timerElapsed;
+  // Video memory put back together from the checkpoints
+  uint8_t _video[VIDEO_MEMORY_SIZE];
+  std::atomic<uint32_t> _requested;
+  std::atomic<bool> _held;
+  // For the report
+  uint64_t _checkpointCount;
+  uint64_t _keyframeCount;
+  uint64_t _checkpointBytes;
+  uint64_t _checkpointNanos;
+  uint64_t _checkpointMaxNanos;
+  uint64_t _stepCount;
+  uint64_t _startNanos;
+};
+
+#endif
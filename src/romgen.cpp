@@ -0,0 +1,124 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include "defs.h"
+
+// Writes a random ROM for the differential test, the same one for the
+// same seed on every host. The registers are set up first, SP high in
+// memory, and then comes a mix of ALU instructions, moves, loads and
+// stores (some of them into the code itself), jumps and calls that
+// mostly go forward, and now and then one to anywhere in it. It ends
+// by drawing a pixel in each color register and starting over after
+// the registers are set up, running whatever the stores left there.
+
+// Xorshift, so that the ROMs don't depend on the standard library
+class RomRandom {
+ public:
+  RomRandom(const uint64_t& seed) : _state(seed * 0x9e3779b97f4a7c15 | 1) { }
+  uint32_t below(const uint32_t& n) {
+    _state ^= _state << 13;
+    _state ^= _state >> 7;
+    _state ^= _state << 17;
+    return (_state >> 32) % n;
+  }
+  template <size_t N>
+  uint8_t choose(const uint8_t (&choices)[N]) {
+    return choices[below(N)];
+  }
+
+ private:
+  uint64_t _state;
+};
+
+static void inst(std::vector<uint8_t>& rom, const uint8_t& opcode,
+                 const uint8_t& a, const uint8_t& b, const uint8_t& c) {
+  rom.push_back(opcode);
+  rom.push_back(a);
+  rom.push_back(b);
+  rom.push_back(c);
+}
+
+int main(int argc, char **argv) {
+  if (3 != argc) {
+    std::cerr << "Usage: " << argv[0] << " SEED ROM" << std::endl;
+    return 1;
+  }
+  RomRandom random(strtoull(argv[1], nullptr, 0));
+  const uint8_t regOps[] = {
+    OPCODE_INPUT, OPCODE_LOAD, OPCODE_MOV, OPCODE_PUSH, OPCODE_POP,
+    OPCODE_ADD, OPCODE_SUB, OPCODE_MUL, OPCODE_DIV, OPCODE_AND, OPCODE_OR,
+    OPCODE_XOR, OPCODE_SHL, OPCODE_SHRA, OPCODE_SHRL, OPCODE_CMP,
+    OPCODE_TST, OPCODE_COLOR, OPCODE_PIXEL, OPCODE_STOR, OPCODE_RND
+  };
+  const uint8_t jumpOps[] = {
+    OPCODE_JMPI, OPCODE_CALL, OPCODE_JEQ, OPCODE_JNE, OPCODE_JG,
+    OPCODE_JGE, OPCODE_JA, OPCODE_JAE, OPCODE_JL, OPCODE_JLE, OPCODE_JB,
+    OPCODE_JBE, OPCODE_JO, OPCODE_JNO, OPCODE_JS, OPCODE_JNS
+  };
+  const uint8_t otherOps[] = {
+    OPCODE_RET, OPCODE_JMP, OPCODE_NOP, 0x2f, OPCODE_TIME,
+    OPCODE_TIMERST, OPCODE_TIME
+  };
+  const uint8_t sizes[] = { 16, 64, 255 };
+  const uint16_t values[] = { 0, 1, 2, 3, 7, 15, 0x7fff, 0x8000, 0xffff };
+
+  std::vector<uint8_t> rom;
+  for (int reg = 0; reg < NUM_REGISTERS; reg++) {
+    uint16_t value = REG_SP == reg ? 0x8000 : random.below(0x10000);
+    inst(rom, OPCODE_MOVI, reg, value >> 8, value);
+  }
+  int end = NUM_REGISTERS + sizes[random.below(3)];
+  for (int i = NUM_REGISTERS; i < end; i++) {
+    uint32_t kind = random.below(100);
+    if (kind < 45) {
+      // Mostly leave SP alone, or the stack goes everywhere
+      uint8_t reg1 = random.below(100) < 97 ? 1 + random.below(15) : 0;
+      inst(rom, random.choose(regOps), reg1, random.below(16),
+           random.below(256));
+    } else if (kind < 60) {
+      uint16_t value = random.below(3) ? values[random.below(9)] :
+                       random.below(2) ? random.below(0x10000) :
+                       random.below(end * INST_SIZE);
+      inst(rom, OPCODE_MOVI, random.below(16), value >> 8, value);
+    } else if (kind < 70) {
+      uint16_t addr = random.below(2) ? random.below(end * INST_SIZE + 64) :
+                      0x9000 + random.below(64);
+      inst(rom, random.below(2) ? OPCODE_LOADI : OPCODE_STORI,
+           random.below(16), addr >> 8, addr);
+    } else if (kind < 85) {
+      // Forward, and once in a while to the middle of an instruction
+      int from = i + 1 < end - 1 ? i + 1 : end - 1;
+      uint16_t addr = (from + random.below(end - from)) * INST_SIZE +
+                      (0 == random.below(4) ? 1 : 0);
+      inst(rom, random.choose(jumpOps), addr >> 8, addr, 0);
+    } else if (kind < 90) {
+      uint16_t addr = (NUM_REGISTERS +
+                       random.below(end - NUM_REGISTERS)) * INST_SIZE;
+      inst(rom, jumpOps[2 + random.below(14)], addr >> 8, addr, 0);
+    } else {
+      inst(rom, random.choose(otherOps), random.below(4), random.below(16),
+           0);
+    }
+  }
+  for (int reg = 0; reg < NUM_REGISTERS; reg++) {
+    inst(rom, OPCODE_COLOR, reg, 0, 0);
+    inst(rom, OPCODE_PIXEL, reg, (reg * 5 + 3) % 16, 0);
+  }
+  uint16_t start = NUM_REGISTERS * INST_SIZE;
+  inst(rom, OPCODE_JMPI, start >> 8, start, 0);
+
+  std::ofstream out(argv[2], std::ios::binary);
+  out.write((const char *)rom.data(), rom.size());
+  if (!out) {
+    std::cerr << "Error: Failed to write '" << argv[2] << "'." << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,114 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <iostream>
+#include <string.h>
+#include "processor.h"
+#include "savestate.h"
+#include "jit.h"
+
+bool EmuProcessor::saveState(const std::string& state_filename) {
+  // Fill in the whole state and write it out with a single call
+  EmuSaveState *state = new EmuSaveState;
+  memcpy(state->magic, SAVE_STATE_MAGIC, sizeof(state->magic));
+  state->version = SAVE_STATE_VERSION;
+  state->size = sizeof(EmuSaveState);
+  memcpy(state->mainMem, _mainMem, sizeof(state->mainMem));
+  _vidMem->saveState(state->videoMem);
+  memcpy(state->registers, _registers, sizeof(state->registers));
+  state->instructionPointer = _instructionPointer;
+  state->colorRegister = _colorRegister;
+  // The operands of cleared flags are left over from whatever set
+  // them last, so leave them out to keep equal states byte for byte
+  bool cleared = OPCODE_NOP == _flagOpcode;
+  state->flagOpcode = _flagOpcode;
+  state->flagDest = cleared ? 0 : _flagDest;
+  state->flagSrc = cleared ? 0 : _flagSrc;
+  state->flagResult = _flagResult;
+  state->instructionCount = _instructionCount;
+  state->timerElapsed = _timeNow(_instructionCount) - _timerReset;
+  state->timerUnitsPerMilli = _timeUnitsPerMilli();
+  state->randomState = _randomState;
+  state->reserved = 0;
+
+  bool ok = false;
+  int fd = open(state_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (-1 != fd) {
+    ok = sizeof(EmuSaveState) == write(fd, state, sizeof(EmuSaveState));
+    ok = 0 == close(fd) && ok;
+  }
+  delete state;
+  if (!ok) {
+    std::cerr << "Error: Failed to write save state '"
+              << state_filename << "'." << std::endl;
+  }
+  return ok;
+}
+
+bool EmuProcessor::loadState(const std::string& state_filename) {
+  // Map the file and copy the state straight out of it
+  int fd = open(state_filename.c_str(), O_RDONLY);
+  if (-1 == fd) {
+    std::cerr << "Error: Failed to read save state '"
+              << state_filename << "'." << std::endl;
+    return false;
+  }
+  struct stat info;
+  void *map = MAP_FAILED;
+  if (0 == fstat(fd, &info) && sizeof(EmuSaveState) == info.st_size) {
+    map = mmap(nullptr, sizeof(EmuSaveState), PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  const EmuSaveState *state = (const EmuSaveState *)map;
+  if (MAP_FAILED == map ||
+      0 != memcmp(state->magic, SAVE_STATE_MAGIC, sizeof(state->magic)) ||
+      SAVE_STATE_VERSION != state->version ||
+      sizeof(EmuSaveState) != state->size ||
+      0 == state->timerUnitsPerMilli ||
+      OPCODE_JNS < state->flagOpcode ||
+      // RND never moves on from a state of zero
+      0 == state->randomState) {
+    std::cerr << "Error: '" << state_filename << "' is not a save state "
+              << "from this version of the emulator." << std::endl;
+    if (MAP_FAILED != map) {
+      munmap(map, sizeof(EmuSaveState));
+    }
+    return false;
+  }
+
+  memcpy(_mainMem, state->mainMem, sizeof(_mainMem));
+  _vidMem->loadState(state->videoMem);
+  memcpy(_registers, state->registers, sizeof(_registers));
+  _setInstructionPointer(state->instructionPointer);
+  _colorRegister = state->colorRegister;
+  _flagOpcode = state->flagOpcode;
+  _flagDest = state->flagDest;
+  _flagSrc = state->flagSrc;
+  _flagResult = state->flagResult;
+  _instructionCount = state->instructionCount;
+  // The timer carries over exactly if the time base is the same,
+  // and to the millisecond otherwise
+  uint64_t elapsed = state->timerElapsed;
+  if (_timeUnitsPerMilli() != state->timerUnitsPerMilli) {
+    elapsed = (elapsed / state->timerUnitsPerMilli) * _timeUnitsPerMilli();
+  }
+  _timerReset = _timeNow(_instructionCount) - elapsed;
+  _randomState = state->randomState;
+  munmap(map, sizeof(EmuSaveState));
+
+  // All of main memory changed, so nothing decoded or compiled from
+  // the old contents can be trusted
+  for (int slot = 0; slot < MAIN_MEMORY_SIZE / INST_SIZE; slot++) {
+    _decoded[slot].handler = OPCODE_DECODE;
+  }
+  if (nullptr != _jit) {
+    _jit->flush();
+  }
+  return true;
+}
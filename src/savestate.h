@@ -0,0 +1,44 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#ifndef EMU_SAVESTATE_H
+#define EMU_SAVESTATE_H
+
+#include <stdint.h>
+#include "defs.h"
+
+// The file format of a save state, which is the whole machine laid
+// out so that it can be written and read in one go. Values are in the
+// byte order of the host. Any change to the layout must bump
+// SAVE_STATE_VERSION so that old files are rejected.
+struct EmuSaveState {
+  char magic[8];
+  uint32_t version;
+  uint32_t size;
+  uint8_t mainMem[MAIN_MEMORY_SIZE];
+  uint8_t videoMem[VIDEO_MEMORY_SIZE];
+  uint16_t registers[NUM_REGISTERS];
+  uint16_t instructionPointer;
+  uint8_t colorRegister;
+  // The record of the last ALU instruction that the flags come from
+  uint8_t flagOpcode;
+  uint32_t flagDest;
+  uint32_t flagSrc;
+  uint32_t flagResult;
+  uint64_t instructionCount;
+  // The time since the last TIMERST, in units of the time base that
+  // was in use, and the number of those units per millisecond
+  uint64_t timerElapsed;
+  uint64_t timerUnitsPerMilli;
+  uint32_t randomState;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(EmuSaveState) ==
+              16 + MAIN_MEMORY_SIZE + VIDEO_MEMORY_SIZE +
+              (2 * NUM_REGISTERS) + 16 + 32,
+              "Save state layout must not have padding");
+
+#endif
@@ -0,0 +1,217 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#include <string.h>
+#include "scaler.h"
+#include "vidmem.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define EMU_SCALE_SIMD
+#define EMU_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Copies pixels from a palette, which is the only kernel on CPUs
+// without one of the SIMD ones
+template <int Scale>
+static void scaleRowScalar(uint32_t *dest, const uint8_t *src,
+                           const uint32_t *palette) {
+  for (int x = 0; x < VIDEO_WIDTH; x++) {
+    uint32_t pixel = palette[src[x]];
+    for (int i = 0; i < Scale; i++) {
+      *dest++ = pixel;
+    }
+  }
+}
+
+static const EmuScaleRow scalarRows[SCALE_MAX + 1] = {
+  nullptr, scaleRowScalar<1>, scaleRowScalar<2>, scaleRowScalar<3>,
+  scaleRowScalar<4>, scaleRowScalar<5>, scaleRowScalar<6>,
+  scaleRowScalar<7>, scaleRowScalar<8>
+};
+
+#ifdef EMU_SCALE_SIMD
+static_assert(0 == VIDEO_WIDTH % 16, "Rows are expanded 16 at a time");
+
+// The SIMD kernels work out each color without a palette, since each
+// of red, green and blue is only masked and shifted into its byte; see
+// EmuVideoMemory::toRGB(). Scaling repeats each of the pixels in a
+// vector across Scale vectors: lane k of vector j of the output is
+// pixel (lanes * j + k) / Scale, so the shuffles are all constant.
+
+// Stores output vectors J to Scale - 1 of four pixels
+template <int Scale, int J>
+struct EmuSse2Spread {
+  static void store(uint32_t *dest, const __m128i& pixels) {
+    _mm_storeu_si128((__m128i *)dest + J,
+                     _mm_shuffle_epi32(pixels,
+                                       ((4 * J + 0) / Scale) |
+                                       ((4 * J + 1) / Scale) << 2 |
+                                       ((4 * J + 2) / Scale) << 4 |
+                                       ((4 * J + 3) / Scale) << 6));
+    EmuSse2Spread<Scale, J + 1>::store(dest, pixels);
+  }
+};
+
+template <int Scale>
+struct EmuSse2Spread<Scale, Scale> {
+  static void store(uint32_t *, const __m128i&) { }
+};
+
+// SSE2 is part of x86-64, so this needs no check. It expands sixteen
+// pixels at a time by interleaving blue, green, red and zero bytes.
+template <int Scale>
+static void scaleRowSse2(uint32_t *dest, const uint8_t *src,
+                         const uint32_t *) {
+  const __m128i highThree = _mm_set1_epi8((char)0xe0);
+  const __m128i highTwo = _mm_set1_epi8((char)0xc0);
+  const __m128i zero = _mm_setzero_si128();
+  for (int x = 0; x < VIDEO_WIDTH; x += 16) {
+    __m128i colors = _mm_loadu_si128((const __m128i *)(src + x));
+    // There are no byte shifts, so the shifts are on 16-bit lanes, and
+    // the bits they carry up from the low byte of each lane into the
+    // high one are masked off
+    __m128i red = _mm_and_si128(colors, highThree);
+    __m128i green = _mm_and_si128(_mm_slli_epi16(colors, 3), highThree);
+    __m128i blue = _mm_and_si128(_mm_slli_epi16(colors, 6), highTwo);
+    __m128i blueGreenLow = _mm_unpacklo_epi8(blue, green);
+    __m128i blueGreenHigh = _mm_unpackhi_epi8(blue, green);
+    __m128i redLow = _mm_unpacklo_epi8(red, zero);
+    __m128i redHigh = _mm_unpackhi_epi8(red, zero);
+    EmuSse2Spread<Scale, 0>::store(
+      dest, _mm_unpacklo_epi16(blueGreenLow, redLow));
+    EmuSse2Spread<Scale, 0>::store(
+      dest + 4 * Scale, _mm_unpackhi_epi16(blueGreenLow, redLow));
+    EmuSse2Spread<Scale, 0>::store(
+      dest + 8 * Scale, _mm_unpacklo_epi16(blueGreenHigh, redHigh));
+    EmuSse2Spread<Scale, 0>::store(
+      dest + 12 * Scale, _mm_unpackhi_epi16(blueGreenHigh, redHigh));
+    dest += 16 * Scale;
+  }
+}
+
+static const EmuScaleRow sse2Rows[SCALE_MAX + 1] = {
+  nullptr, scaleRowSse2<1>, scaleRowSse2<2>, scaleRowSse2<3>,
+  scaleRowSse2<4>, scaleRowSse2<5>, scaleRowSse2<6>, scaleRowSse2<7>,
+  scaleRowSse2<8>
+};
+
+// Stores output vectors J to Scale - 1 of eight pixels. The lanes
+// cross halves of the vector, so they are permuted rather than
+// shuffled.
+template <int Scale, int J>
+struct EmuAvx2Spread {
+  EMU_AVX2 static void store(uint32_t *dest, const __m256i& pixels) {
+    _mm256_storeu_si256((__m256i *)dest + J,
+                        _mm256_permutevar8x32_epi32(
+                          pixels, _mm256_setr_epi32(
+                            (8 * J + 0) / Scale, (8 * J + 1) / Scale,
+                            (8 * J + 2) / Scale, (8 * J + 3) / Scale,
+                            (8 * J + 4) / Scale, (8 * J + 5) / Scale,
+                            (8 * J + 6) / Scale, (8 * J + 7) / Scale)));
+    EmuAvx2Spread<Scale, J + 1>::store(dest, pixels);
+  }
+};
+
+template <int Scale>
+struct EmuAvx2Spread<Scale, Scale> {
+  EMU_AVX2 static void store(uint32_t *, const __m256i&) { }
+};
+
+// Widens colors to a lane each, eight at a time, and masks and shifts
+// each component straight into place
+EMU_AVX2 static inline __m256i expandAvx2(const __m128i& colors) {
+  __m256i wide = _mm256_cvtepu8_epi32(colors);
+  __m256i red =
+    _mm256_slli_epi32(_mm256_and_si256(wide, _mm256_set1_epi32(0xe0)), 16);
+  __m256i green =
+    _mm256_slli_epi32(_mm256_and_si256(wide, _mm256_set1_epi32(0x1c)), 11);
+  __m256i blue =
+    _mm256_slli_epi32(_mm256_and_si256(wide, _mm256_set1_epi32(0x03)), 6);
+  return _mm256_or_si256(_mm256_or_si256(red, green), blue);
+}
+
+template <int Scale>
+EMU_AVX2 static void scaleRowAvx2(uint32_t *dest, const uint8_t *src,
+                                  const uint32_t *) {
+  for (int x = 0; x < VIDEO_WIDTH; x += 16) {
+    __m128i colors = _mm_loadu_si128((const __m128i *)(src + x));
+    EmuAvx2Spread<Scale, 0>::store(dest, expandAvx2(colors));
+    EmuAvx2Spread<Scale, 0>::store(dest + 8 * Scale,
+                                   expandAvx2(_mm_srli_si128(colors, 8)));
+    dest += 16 * Scale;
+  }
+}
+
+static const EmuScaleRow avx2Rows[SCALE_MAX + 1] = {
+  nullptr, scaleRowAvx2<1>, scaleRowAvx2<2>, scaleRowAvx2<3>,
+  scaleRowAvx2<4>, scaleRowAvx2<5>, scaleRowAvx2<6>, scaleRowAvx2<7>,
+  scaleRowAvx2<8>
+};
+#endif
+
+EmuScaler::EmuScaler(const EmuScaleKernel& kernel) : _kernel(kernel) {
+  if (SCALE_KERNEL_AUTO == _kernel) {
+    _kernel = isSupported(SCALE_KERNEL_AVX2) ? SCALE_KERNEL_AVX2 :
+              isSupported(SCALE_KERNEL_SSE2) ? SCALE_KERNEL_SSE2 :
+                                               SCALE_KERNEL_SCALAR;
+  } else if (!isSupported(_kernel)) {
+    _kernel = SCALE_KERNEL_SCALAR;
+  }
+  _rows = scalarRows;
+#ifdef EMU_SCALE_SIMD
+  if (SCALE_KERNEL_AVX2 == _kernel) {
+    _rows = avx2Rows;
+  } else if (SCALE_KERNEL_SSE2 == _kernel) {
+    _rows = sse2Rows;
+  }
+#endif
+  for (int color = 0; color < 256; color++) {
+    _palette[color] = EmuVideoMemory::toRGB(color);
+  }
+}
+
+bool EmuScaler::isSupported(const EmuScaleKernel& kernel) {
+  switch (kernel) {
+  case SCALE_KERNEL_AUTO:
+  case SCALE_KERNEL_SCALAR:
+    return true;
+#ifdef EMU_SCALE_SIMD
+  case SCALE_KERNEL_SSE2:
+    return true;
+  case SCALE_KERNEL_AVX2:
+    return __builtin_cpu_supports("avx2");
+#endif
+  default:
+    return false;
+  }
+}
+
+const char *EmuScaler::getName() {
+  switch (_kernel) {
+  case SCALE_KERNEL_AVX2: return "avx2";
+  case SCALE_KERNEL_SSE2: return "sse2";
+  default:                return "scalar";
+  }
+}
+
+void EmuScaler::scaleRows(uint32_t *dest, const int& stride,
+                          const uint8_t *frame, const int& first_row,
+                          const int& num_rows, const int& scale) {
+  // Each row is expanded once, and the rows under it that make up the
+  // rest of its scaled height are copied from it while it is still
+  // in the cache
+  EmuScaleRow row = _rows[scale];
+  size_t width = VIDEO_WIDTH * scale * sizeof(uint32_t);
+  uint8_t *out = (uint8_t *)dest + (first_row * scale * stride);
+  const uint8_t *src = frame + (first_row * VIDEO_WIDTH);
+  for (int y = 0; y < num_rows; y++) {
+    row((uint32_t *)out, src, _palette);
+    for (int i = 1; i < scale; i++) {
+      memcpy(out + (i * stride), out, width);
+    }
+    out += scale * stride;
+    src += VIDEO_WIDTH;
+  }
+}
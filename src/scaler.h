@@ -0,0 +1,49 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#ifndef EMU_SCALER_H
+#define EMU_SCALER_H
+
+#include <stdint.h>
+#include "defs.h"
+
+// The kernels that can expand and scale rows of a frame
+enum EmuScaleKernel {
+  // The fastest one that the CPU supports
+  SCALE_KERNEL_AUTO,
+  SCALE_KERNEL_SCALAR,
+  SCALE_KERNEL_SSE2,
+  SCALE_KERNEL_AVX2
+};
+
+// Expands one row of 8-bit video memory into 0x00RRGGBB pixels, each
+// repeated across the scale
+typedef void (*EmuScaleRow)(uint32_t *dest, const uint8_t *src,
+                            const uint32_t *palette);
+
+// Expands rows of 8-bit frames into 0x00RRGGBB pixels and scales them
+// up by a whole number from 1 to SCALE_MAX in the same pass, straight
+// into the destination image. Each kernel is compiled once for each
+// scale, and the one to use is picked when the CPU is known.
+class EmuScaler {
+ public:
+  EmuScaler(const EmuScaleKernel& kernel);
+  static bool isSupported(const EmuScaleKernel& kernel);
+  EmuScaleKernel getKernel() { return _kernel; }
+  const char *getName();
+  // Writes num_rows rows of the frame from first_row, scaled, to dest,
+  // which is where the top left of the whole frame goes. Rows of dest
+  // are stride bytes apart.
+  void scaleRows(uint32_t *dest, const int& stride, const uint8_t *frame,
+                 const int& first_row, const int& num_rows,
+                 const int& scale);
+
+ private:
+  EmuScaleKernel _kernel;
+  const EmuScaleRow *_rows;
+  uint32_t _palette[256];
+};
+
+#endif
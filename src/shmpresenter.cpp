@@ -0,0 +1,205 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <string.h>
+#include <algorithm>
+#include "shmpresenter.h"
+
+// Set if the X server refuses to attach to the shared memory, which
+// it does when it is on another machine
+static bool attachFailed;
+
+static int attachErrorHandler(Display *, XErrorEvent *) {
+  attachFailed = true;
+  return 0;
+}
+
+EmuShmPresenter::EmuShmPresenter(Display *display,
+                                 Window window,
+                                 Visual *visual,
+                                 const int& depth,
+                                 const int& width,
+                                 const int& height)
+                                : _display(display),
+                                  _window(window),
+                                  _visual(visual),
+                                  _depth(depth),
+                                  _gc(nullptr),
+                                  _image(nullptr),
+                                  _width(width),
+                                  _height(height),
+                                  _scaler(SCALE_KERNEL_AUTO),
+                                  _scale(0),
+                                  _left(0),
+                                  _top(0) {
+  _name = std::string("shm, ") + _scaler.getName();
+  // Pixels are written as 0x00RRGGBB words, so the visual has to
+  // store them that way
+  if (!XShmQueryExtension(_display) ||
+      0xff0000 != _visual->red_mask ||
+      0x00ff00 != _visual->green_mask ||
+      0x0000ff != _visual->blue_mask) {
+    return;
+  }
+  for (int color = 0; color < 256; color++) {
+    _palette[color] = EmuVideoMemory::toRGB(color);
+  }
+  _gc = XCreateGC(_display, _window, 0, nullptr);
+  if (!_createImage()) {
+    XFreeGC(_display, _gc);
+    _gc = nullptr;
+  }
+}
+
+EmuShmPresenter::~EmuShmPresenter() {
+  if (nullptr != _image) {
+    _destroyImage();
+  }
+  if (nullptr != _gc) {
+    XFreeGC(_display, _gc);
+  }
+}
+
+bool EmuShmPresenter::_createImage() {
+  _image = XShmCreateImage(_display, _visual, _depth, ZPixmap, nullptr,
+                           &_shmInfo, _width, _height);
+  if (nullptr == _image) {
+    return false;
+  }
+  if (32 != _image->bits_per_pixel || LSBFirst != _image->byte_order) {
+    XDestroyImage(_image);
+    _image = nullptr;
+    return false;
+  }
+  _shmInfo.shmid = shmget(IPC_PRIVATE, _image->bytes_per_line * _height,
+                          IPC_CREAT | 0600);
+  if (-1 == _shmInfo.shmid) {
+    XDestroyImage(_image);
+    _image = nullptr;
+    return false;
+  }
+  void *addr = shmat(_shmInfo.shmid, nullptr, 0);
+  if ((void *)-1 == addr) {
+    shmctl(_shmInfo.shmid, IPC_RMID, nullptr);
+    XDestroyImage(_image);
+    _image = nullptr;
+    return false;
+  }
+  _shmInfo.shmaddr = _image->data = (char *)addr;
+  _shmInfo.readOnly = False;
+  attachFailed = false;
+  XErrorHandler oldHandler = XSetErrorHandler(attachErrorHandler);
+  XShmAttach(_display, &_shmInfo);
+  XSync(_display, False);
+  XSetErrorHandler(oldHandler);
+  // Mark the segment for removal now that both sides have it, so that
+  // it goes away once they detach even if we crash
+  shmctl(_shmInfo.shmid, IPC_RMID, nullptr);
+  if (attachFailed) {
+    shmdt(_shmInfo.shmaddr);
+    _image->data = nullptr;
+    XDestroyImage(_image);
+    _image = nullptr;
+    return false;
+  }
+
+  // Work out how far to scale frames up, or which column of video
+  // memory each window column shows if they have to be scaled down.
+  // Nothing is drawn around the frame; the window background is black,
+  // and X clears the window to it when it is resized.
+  _scale = std::min(std::min(_width / VIDEO_WIDTH, _height / VIDEO_HEIGHT),
+                    SCALE_MAX);
+  _left = (_width - (VIDEO_WIDTH * _scale)) / 2;
+  _top = (_height - (VIDEO_HEIGHT * _scale)) / 2;
+  _columns.clear();
+  if (0 == _scale) {
+    _columns.resize(_width);
+    for (int x = 0; x < _width; x++) {
+      _columns[x] = x * VIDEO_WIDTH / _width;
+    }
+  }
+  return true;
+}
+
+void EmuShmPresenter::_destroyImage() {
+  XShmDetach(_display, &_shmInfo);
+  XSync(_display, False);
+  _image->data = nullptr;
+  XDestroyImage(_image);
+  shmdt(_shmInfo.shmaddr);
+  _image = nullptr;
+}
+
+bool EmuShmPresenter::resize(const int& width, const int& height) {
+  if (nullptr != _image) {
+    _destroyImage();
+  }
+  _width = width;
+  _height = height;
+  if (!_createImage()) {
+    // The window has to be presented some other way from now on
+    XFreeGC(_display, _gc);
+    _gc = nullptr;
+    return false;
+  }
+  return true;
+}
+
+void EmuShmPresenter::present(EmuVideoMemory *vid_mem,
+                              const std::vector<EmuDamage>& damage) {
+  if (nullptr == _image) {
+    return;
+  }
+  const uint8_t *frame = vid_mem->getFrameData();
+  if (0 != _scale) {
+    _presentScaled(frame, damage);
+    return;
+  }
+  int stride = _image->bytes_per_line;
+  for (const EmuDamage& rows : damage) {
+    // The window rows that show the damaged rows of video memory
+    int top = (rows.firstRow * _height + VIDEO_HEIGHT - 1) / VIDEO_HEIGHT;
+    int bottom = ((rows.firstRow + rows.numRows) * _height +
+                  VIDEO_HEIGHT - 1) / VIDEO_HEIGHT;
+    int lastRow = -1;
+    for (int y = top; y < bottom; y++) {
+      uint32_t *dest = (uint32_t *)(_image->data + (y * stride));
+      int row = y * VIDEO_HEIGHT / _height;
+      if (row == lastRow) {
+        // Scaled up rows are copies of the one above
+        memcpy(dest, (uint8_t *)dest - stride, _width * sizeof(uint32_t));
+        continue;
+      }
+      const uint8_t *src = frame + (row * VIDEO_WIDTH);
+      for (int x = 0; x < _width; x++) {
+        dest[x] = _palette[src[_columns[x]]];
+      }
+      lastRow = row;
+    }
+    if (top < bottom) {
+      XShmPutImage(_display, _window, _gc, _image, 0, top, 0, top,
+                   _width, bottom - top, False);
+    }
+  }
+  // The image must not be written to again until the server is done
+  // reading it
+  XSync(_display, False);
+}
+
+void EmuShmPresenter::_presentScaled(const uint8_t *frame,
+                                     const std::vector<EmuDamage>& damage) {
+  int stride = _image->bytes_per_line;
+  uint32_t *origin = (uint32_t *)(_image->data + (_top * stride)) + _left;
+  for (const EmuDamage& rows : damage) {
+    _scaler.scaleRows(origin, stride, frame, rows.firstRow, rows.numRows,
+                      _scale);
+    int top = _top + (rows.firstRow * _scale);
+    XShmPutImage(_display, _window, _gc, _image, _left, top, _left, top,
+                 VIDEO_WIDTH * _scale, rows.numRows * _scale, False);
+  }
+  XSync(_display, False);
+}
@@ -0,0 +1,62 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#ifndef EMU_SHMPRESENTER_H
+#define EMU_SHMPRESENTER_H
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <string>
+#include <vector>
+#include "presenter.h"
+#include "scaler.h"
+
+// Scales frames straight into an XImage in memory shared with the X
+// server, and puts the damaged part of it in the window with
+// XShmPutImage, so that no pixels go through the X socket. Frames are
+// scaled up by the largest whole number that fits the window, and
+// centered in it with black bars, the window's background, around
+// them. Windows smaller than a frame get every nth column and row.
+class EmuShmPresenter : public EmuPresenter {
+ public:
+  EmuShmPresenter(Display *display, Window window, Visual *visual,
+                  const int& depth, const int& width, const int& height);
+  ~EmuShmPresenter();
+  bool hasError() { return nullptr == _image; }
+  const char *getName() { return _name.c_str(); }
+  bool resize(const int& width, const int& height);
+  void present(EmuVideoMemory *vid_mem,
+               const std::vector<EmuDamage>& damage);
+
+ private:
+  bool _createImage();
+  void _destroyImage();
+  void _presentScaled(const uint8_t *frame,
+                      const std::vector<EmuDamage>& damage);
+
+  Display *_display;
+  Window _window;
+  Visual *_visual;
+  int _depth;
+  GC _gc;
+  XImage *_image;
+  XShmSegmentInfo _shmInfo;
+  int _width;
+  int _height;
+  std::string _name;
+  EmuScaler _scaler;
+  // The whole number that frames are scaled by, or 0 if the window is
+  // too small, and where the top left of the frame goes
+  int _scale;
+  int _left;
+  int _top;
+  // The column of video memory that each column of the window shows,
+  // when the window is too small
+  std::vector<int> _columns;
+  uint32_t _palette[256];
+};
+
+#endif
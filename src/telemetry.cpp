@@ -0,0 +1,233 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <iostream>
+#include <string.h>
+#include "telemetry.h"
+
+EmuTelemetry::EmuTelemetry(const std::string& destination)
+                          : _destination(destination),
+                            _fd(-1),
+                            _error(false),
+                            _writeFailed(false),
+                            _stopping(false) {
+  _processor.instructions.store(0, std::memory_order_relaxed);
+  _processor.pixels.store(0, std::memory_order_relaxed);
+  _processor.published.store(0, std::memory_order_relaxed);
+  _window.frames.store(0, std::memory_order_relaxed);
+  _window.skipped.store(0, std::memory_order_relaxed);
+  _window.inputs.store(0, std::memory_order_relaxed);
+  _window.drawNanos.store(0, std::memory_order_relaxed);
+  for (int i = 0; i < TELEMETRY_DRAW_BUCKETS; i++) {
+    _window.drawHistogram[i].store(0, std::memory_order_relaxed);
+  }
+
+  const std::string prefix = "unix:";
+  if (0 == destination.compare(0, prefix.size(), prefix)) {
+    if (!_listen(destination.substr(prefix.size()))) {
+      std::cerr << "Error: Cannot listen on the stats socket '"
+                << destination.substr(prefix.size()) << "'." << std::endl;
+      _error = true;
+      return;
+    }
+  } else if (!destination.empty()) {
+    _fd = open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (-1 == _fd) {
+      std::cerr << "Error: Failed to open stats file '"
+                << destination << "'." << std::endl;
+      _error = true;
+      return;
+    }
+  }
+  _publisher = std::thread(&EmuTelemetry::_publisherLoop, this);
+}
+
+EmuTelemetry::~EmuTelemetry() {
+  stop();
+}
+
+bool EmuTelemetry::_listen(const std::string& path) {
+  // Clients connect whenever they like and get every line from then
+  // on. A socket left behind by an earlier run is replaced, but
+  // nothing else is.
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || sizeof(addr.sun_path) <= path.size()) {
+    return false;
+  }
+  memcpy(addr.sun_path, path.c_str(), path.size());
+  struct stat info;
+  if (0 == lstat(path.c_str(), &info) && S_ISSOCK(info.st_mode)) {
+    unlink(path.c_str());
+  }
+  _fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (-1 == _fd) {
+    return false;
+  }
+  if (0 != bind(_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+      0 != listen(_fd, TELEMETRY_MAX_CLIENTS)) {
+    close(_fd);
+    _fd = -1;
+    return false;
+  }
+  _socketPath = path;
+  return true;
+}
+
+bool EmuTelemetry::stop() {
+  if (_publisher.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopping = true;
+    }
+    _wake.notify_all();
+    _publisher.join();
+  }
+  for (int client : _clients) {
+    close(client);
+  }
+  _clients.clear();
+  if (-1 != _fd) {
+    if (0 != close(_fd) && _socketPath.empty()) {
+      _writeFailed = true;
+    }
+    _fd = -1;
+    if (!_socketPath.empty()) {
+      unlink(_socketPath.c_str());
+    } else if (_writeFailed) {
+      std::cerr << "Error: Failed to write stats file '"
+                << _destination << "'." << std::endl;
+    }
+  }
+  return !_error && !_writeFailed;
+}
+
+std::string EmuTelemetry::getOverlayText() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _overlayText;
+}
+
+void EmuTelemetry::_take(Snapshot& snapshot) {
+  snapshot.instructions =
+    _processor.instructions.load(std::memory_order_relaxed);
+  snapshot.pixels = _processor.pixels.load(std::memory_order_relaxed);
+  snapshot.published = _processor.published.load(std::memory_order_relaxed);
+  snapshot.frames = _window.frames.load(std::memory_order_relaxed);
+  snapshot.skipped = _window.skipped.load(std::memory_order_relaxed);
+  snapshot.inputs = _window.inputs.load(std::memory_order_relaxed);
+  snapshot.drawNanos = _window.drawNanos.load(std::memory_order_relaxed);
+  for (int i = 0; i < TELEMETRY_DRAW_BUCKETS; i++) {
+    snapshot.drawHistogram[i] =
+      _window.drawHistogram[i].load(std::memory_order_relaxed);
+  }
+}
+
+void EmuTelemetry::_publisherLoop() {
+  // Publish on a fixed cadence from the start, so that lines don't
+  // drift however long each one takes
+  Clock::time_point start = Clock::now();
+  Clock::time_point lastTime = start;
+  Clock::time_point deadline = start;
+  Snapshot last;
+  _take(last);
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (!_stopping) {
+    deadline += std::chrono::milliseconds(TELEMETRY_PERIOD_MILLIS);
+    if (_wake.wait_until(lock, deadline, [this] { return _stopping; })) {
+      break;
+    }
+    lock.unlock();
+    Snapshot now;
+    _take(now);
+    Clock::time_point nowTime = Clock::now();
+    _publish(last, now,
+             std::chrono::duration<double>(nowTime - lastTime).count(),
+             std::chrono::duration<double>(nowTime - start).count());
+    last = now;
+    lastTime = nowTime;
+    lock.lock();
+  }
+}
+
+void EmuTelemetry::_publish(const Snapshot& last, const Snapshot& now,
+                            const double& seconds, const double& elapsed) {
+  // Everything but the instruction count is for this period alone
+  uint64_t instructions = now.instructions - last.instructions;
+  uint64_t published = now.published - last.published;
+  uint64_t frames = now.frames - last.frames;
+  double mips = 0 < seconds ? instructions / seconds / 1000000 : 0;
+  double pixelsPerFrame =
+    0 < published ? (double)(now.pixels - last.pixels) / published : 0;
+  double drawMicros =
+    0 < frames ? (now.drawNanos - last.drawNanos) / 1000.0 / frames : 0;
+  char line[TELEMETRY_LINE_SIZE];
+  int length = snprintf(
+    line, sizeof(line),
+    "time=%.3f instructions=%llu mips=%.2f published=%llu "
+    "pixels_per_frame=%.1f frames=%llu skipped=%llu draw_avg_us=%.1f "
+    "draw_hist=",
+    elapsed, (unsigned long long)now.instructions, mips,
+    (unsigned long long)published, pixelsPerFrame,
+    (unsigned long long)frames,
+    (unsigned long long)(now.skipped - last.skipped), drawMicros);
+  for (int i = 0; i < TELEMETRY_DRAW_BUCKETS; i++) {
+    length += snprintf(
+      line + length, sizeof(line) - length, i ? ",%llu" : "%llu",
+      (unsigned long long)(now.drawHistogram[i] - last.drawHistogram[i]));
+  }
+  snprintf(line + length, sizeof(line) - length, " inputs=%llu\n",
+           (unsigned long long)(now.inputs - last.inputs));
+  _send(line);
+
+  char overlay[TELEMETRY_LINE_SIZE];
+  snprintf(overlay, sizeof(overlay),
+           "%7.1f MIPS %4.0f fps %6.2f ms draw %3llu skipped",
+           mips, 0 < seconds ? frames / seconds : 0, drawMicros / 1000,
+           (unsigned long long)(now.skipped - last.skipped));
+  std::lock_guard<std::mutex> lock(_mutex);
+  _overlayText = overlay;
+}
+
+void EmuTelemetry::_send(const std::string& line) {
+  if (!_socketPath.empty()) {
+    // Take on anyone who connected since the last line, and let go of
+    // anyone who hung up or is too slow to keep up
+    int client;
+    while (-1 != (client = accept4(_fd, nullptr, nullptr,
+                                   SOCK_NONBLOCK | SOCK_CLOEXEC))) {
+      _clients.push_back(client);
+    }
+    for (size_t i = 0; i < _clients.size(); ) {
+      ssize_t n = send(_clients[i], line.data(), line.size(),
+                       MSG_NOSIGNAL | MSG_DONTWAIT);
+      if ((size_t)n != line.size()) {
+        close(_clients[i]);
+        _clients.erase(_clients.begin() + i);
+      } else {
+        i++;
+      }
+    }
+    return;
+  }
+  size_t done = 0;
+  while (-1 != _fd && !_writeFailed && done < line.size()) {
+    ssize_t n = write(_fd, line.data() + done, line.size() - done);
+    if (n < 0 && EINTR == errno) {
+      continue;
+    } else if (n < 0) {
+      _writeFailed = true;
+      break;
+    }
+    done += n;
+  }
+}
@@ -0,0 +1,123 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#ifndef EMU_TELEMETRY_H
+#define EMU_TELEMETRY_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "defs.h"
+
+// Counters written by the processor thread. Only one thread writes
+// each set of counters, so they are bumped with a relaxed load and
+// store rather than a locked add, and each set is padded onto cache
+// lines of its own so that the publisher reading them costs the
+// writers nothing.
+struct EmuProcessorCounters {
+  std::atomic<uint64_t> instructions;
+  std::atomic<uint64_t> pixels;
+  std::atomic<uint64_t> published;
+  uint8_t padding[CACHE_LINE_SIZE];
+};
+
+// Counters written by the window thread. Draw times go into buckets
+// that are each twice as wide as the last, starting from 1us.
+struct EmuWindowCounters {
+  std::atomic<uint64_t> frames;
+  std::atomic<uint64_t> skipped;
+  std::atomic<uint64_t> inputs;
+  std::atomic<uint64_t> drawNanos;
+  std::atomic<uint64_t> drawHistogram[TELEMETRY_DRAW_BUCKETS];
+  uint8_t padding[CACHE_LINE_SIZE];
+};
+
+// Publishes live performance counters once a period, as a line of
+// space separated key=value pairs, to a file or to every client of a
+// Unix socket given as "unix:PATH". The latest numbers are also kept
+// as a short line of text for the window to show on screen.
+class EmuTelemetry {
+ public:
+  // An empty destination publishes nowhere, for the overlay alone
+  EmuTelemetry(const std::string& destination);
+  ~EmuTelemetry();
+  bool hasError() { return _error; }
+
+  // Processor side, once a slice
+  void retired(const uint64_t& instruction_count,
+               const uint64_t& pixel_writes,
+               const uint64_t& frames_published) {
+    _processor.instructions.store(instruction_count,
+                                  std::memory_order_relaxed);
+    _processor.pixels.store(pixel_writes, std::memory_order_relaxed);
+    _processor.published.store(frames_published, std::memory_order_relaxed);
+  }
+
+  // Window side
+  void presented(const uint64_t& draw_nanos) {
+    int bucket = 0;
+    for (uint64_t micros = draw_nanos / 1000;
+         1 < micros && bucket < TELEMETRY_DRAW_BUCKETS - 1; micros >>= 1) {
+      bucket++;
+    }
+    _bump(_window.frames, 1);
+    _bump(_window.drawNanos, draw_nanos);
+    _bump(_window.drawHistogram[bucket], 1);
+  }
+  void skipped(const uint64_t& deadlines) {
+    _bump(_window.skipped, deadlines);
+  }
+  void inputHandled() { _bump(_window.inputs, 1); }
+  std::string getOverlayText();
+
+  // Stops publishing, returning whether every line made it out
+  bool stop();
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+  struct Snapshot {
+    uint64_t instructions;
+    uint64_t pixels;
+    uint64_t published;
+    uint64_t frames;
+    uint64_t skipped;
+    uint64_t inputs;
+    uint64_t drawNanos;
+    uint64_t drawHistogram[TELEMETRY_DRAW_BUCKETS];
+  };
+  static void _bump(std::atomic<uint64_t>& counter, const uint64_t& n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+  }
+  bool _listen(const std::string& path);
+  void _publisherLoop();
+  void _take(Snapshot& snapshot);
+  void _publish(const Snapshot& last, const Snapshot& now,
+                const double& seconds, const double& elapsed);
+  void _send(const std::string& line);
+
+  std::string _destination;
+  std::string _socketPath;
+  int _fd;
+  std::vector<int> _clients;
+  bool _error;
+  bool _writeFailed;
+  uint8_t _leadingPadding[CACHE_LINE_SIZE];
+  EmuProcessorCounters _processor;
+  EmuWindowCounters _window;
+  // The publisher thread, and what it shows on screen
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  bool _stopping;
+  std::string _overlayText;
+  std::thread _publisher;
+};
+
+#endif
@@ -0,0 +1,439 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#include "processor.h"
+#include "tracer.h"
+#include "debugger.h"
+
+void EmuProcessor::_decode(const uint16_t& slot) {
+  const uint8_t *inst = &_mainMem[slot * INST_SIZE];
+  EmuDecodedInst& decoded = _decoded[slot];
+  // Unknown opcodes behave like NOP
+  uint8_t opcode = inst[0];
+  if ((OPCODE_RND < opcode && opcode < OPCODE_JMP) || OPCODE_JNS < opcode) {
+    opcode = OPCODE_NOP;
+  }
+  decoded.handler = opcode;
+  decoded.reg1 = inst[1] & 0xf;
+  decoded.reg2 = inst[2] & 0xf;
+  decoded.arg1 = inst[1];
+  // argA is only ever used as a jump target, so it is stored
+  // already aligned to an instruction boundary.
+  decoded.argA = ((inst[1] << 8) | inst[2]) & 0xfffc;
+  decoded.argB = (inst[2] << 8) | inst[3];
+  if (nullptr != _debugger && _debugger->breaksAt(slot * INST_SIZE)) {
+    decoded.handler = OPCODE_BREAK;
+    return;
+  }
+
+  // Fuse the instruction with the next one when they make one of the
+  // pairs that compiled code is full of. The next slot is still
+  // decoded on its own, for when something jumps straight to it.
+  // Traces need a record of every instruction, so nothing is fused,
+  // and nothing is fused with a breakpoint, which has to be reached.
+  if (MAIN_MEMORY_SIZE / INST_SIZE - 1 == slot || nullptr != _tracer ||
+      (nullptr != _debugger &&
+       _debugger->hasBreakpoint((slot + 1) * INST_SIZE))) {
+    return;
+  }
+  const uint8_t *next = inst + INST_SIZE;
+  uint8_t nextRegs = ((next[1] & 0xf) << 4) | (next[2] & 0xf);
+  uint16_t nextTarget = ((next[1] << 8) | next[2]) & 0xfffc;
+  switch (opcode) {
+  case OPCODE_CMP:
+  case OPCODE_TST:
+    if (OPCODE_JEQ <= next[0] && next[0] <= OPCODE_JNS) {
+      decoded.handler = (OPCODE_CMP == opcode ? OPCODE_FUSED_CMP :
+                                                OPCODE_FUSED_TST) +
+                        next[0] - OPCODE_JEQ;
+      decoded.argA = nextTarget;
+    }
+    break;
+  case OPCODE_MOVI:
+    // Division has its own rules for zero, and is rare anyway
+    if (OPCODE_ADD <= next[0] && next[0] <= OPCODE_TST &&
+        OPCODE_DIV != next[0]) {
+      decoded.handler = OPCODE_FUSED_MOVI + next[0] - OPCODE_ADD;
+      decoded.arg1 = nextRegs;
+    }
+    break;
+  case OPCODE_LOAD:
+    if (OPCODE_ADD == next[0]) {
+      decoded.handler = OPCODE_FUSED_LOAD_ADD;
+      decoded.arg1 = nextRegs;
+    }
+    break;
+  case OPCODE_PUSH:
+    if (OPCODE_CALL == next[0]) {
+      decoded.handler = OPCODE_FUSED_PUSH_CALL;
+      decoded.argA = nextTarget;
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+template <bool Traced>
+uint64_t EmuProcessor::_runThreaded(const uint64_t& max_instructions) {
+  // Handler addresses indexed by the decoded handler byte. Opcodes
+  // that don't exist are decoded as NOP and never reach the gaps.
+  static const void *const dispatch[NUM_HANDLERS] = {
+    &&op_nop, &&op_input, &&op_call, &&op_ret,
+    &&op_load, &&op_loadi, &&op_mov, &&op_movi,
+    &&op_push, &&op_pop, &&op_add, &&op_sub,
+    &&op_mul, &&op_div, &&op_and, &&op_or,
+    &&op_xor, &&op_shl, &&op_shra, &&op_shrl,
+    &&op_cmp, &&op_tst, &&op_color, &&op_pixel,
+    &&op_stor, &&op_stori, &&op_time, &&op_timerst,
+    &&op_rnd, &&op_nop, &&op_nop, &&op_nop,
+    &&op_nop, &&op_nop, &&op_nop, &&op_nop,
+    &&op_nop, &&op_nop, &&op_nop, &&op_nop,
+    &&op_nop, &&op_nop, &&op_nop, &&op_nop,
+    &&op_nop, &&op_nop, &&op_nop, &&op_nop,
+    &&op_jmp, &&op_jmpi, &&op_jeq, &&op_jne,
+    &&op_jg, &&op_jge, &&op_ja, &&op_jae,
+    &&op_jl, &&op_jle, &&op_jb, &&op_jbe,
+    &&op_jo, &&op_jno, &&op_js, &&op_jns,
+    &&op_decode,
+    &&op_cmp_jeq, &&op_cmp_jne, &&op_cmp_jg, &&op_cmp_jge,
+    &&op_cmp_ja, &&op_cmp_jae, &&op_cmp_jl, &&op_cmp_jle,
+    &&op_cmp_jb, &&op_cmp_jbe, &&op_cmp_jo, &&op_cmp_jno,
+    &&op_cmp_js, &&op_cmp_jns,
+    &&op_tst_jeq, &&op_tst_jne, &&op_tst_jg, &&op_tst_jge,
+    &&op_tst_ja, &&op_tst_jae, &&op_tst_jl, &&op_tst_jle,
+    &&op_tst_jb, &&op_tst_jbe, &&op_tst_jo, &&op_tst_jno,
+    &&op_tst_js, &&op_tst_jns,
+    &&op_movi_add, &&op_movi_sub, &&op_movi_mul, &&op_nop,
+    &&op_movi_and, &&op_movi_or, &&op_movi_xor, &&op_movi_shl,
+    &&op_movi_shra, &&op_movi_shrl, &&op_movi_cmp, &&op_movi_tst,
+    &&op_load_add, &&op_push_call, &&op_break
+  };
+
+  uint16_t ip = _instructionPointer;
+  uint64_t remaining = max_instructions;
+  const EmuDecodedInst *inst;
+  uint64_t fused = 0;
+  // Where the trace is up to, kept here while running, see
+  // EmuTraceCursor
+  EmuTraceCursor trace = { nullptr, nullptr, 0 };
+  if (Traced) {
+    trace = _tracer->resume();
+  }
+
+// Fetch the next predecoded instruction and jump to its handler,
+// recording it first when tracing
+#define DISPATCH() \
+  if (0 == remaining) { \
+    goto done; \
+  } \
+  remaining--; \
+  inst = &_decoded[ip / INST_SIZE]; \
+  if (Traced) { \
+    if (OPCODE_DECODE == inst->handler) { \
+      _decode(ip / INST_SIZE); \
+    } \
+    _tracer->step(trace, ip, inst->handler, inst->reg1, _registers); \
+  } \
+  goto *dispatch[inst->handler]
+// Move on to the next instruction, clearing the flags
+#define NEXT() \
+  ip += INST_SIZE; \
+  _clearFlags(); \
+  DISPATCH()
+// Jump to target, clearing the flags
+#define JUMP(target) \
+  ip = (target); \
+  _clearFlags(); \
+  DISPATCH()
+// Jump to the instruction's address if cond holds
+#define BRANCH(cond) \
+  if (cond) { \
+    JUMP(inst->argA); \
+  } \
+  NEXT()
+// Run an ALU instruction, then move on with the flags set from it
+#define ALU(op) \
+  _alu<op>(inst->reg1, _registers[inst->reg1], _registers[inst->reg2]); \
+  ip += INST_SIZE; \
+  DISPATCH()
+// Take the second instruction of a fused pair from the budget, or
+// run only the first one if the budget has run out
+#define FUSE(first) \
+  if (0 == remaining) { \
+    goto first; \
+  } \
+  remaining--; \
+  fused += 2
+// Run the ALU instruction in the second half of a fused pair, with
+// its registers packed into arg1
+#define FUSED_ALU(op) \
+  _alu<op>(inst->arg1 >> 4, _registers[inst->arg1 >> 4], \
+           _registers[inst->arg1 & 0xf]); \
+  ip += 2 * INST_SIZE; \
+  DISPATCH()
+// Compare or test, then jump to the next slot's target if cond holds
+#define FUSED_BRANCH(first, op, cond) \
+  FUSE(first); \
+  _alu<op>(inst->reg1, _registers[inst->reg1], _registers[inst->reg2]); \
+  if (cond) { \
+    JUMP(inst->argA); \
+  } \
+  ip += 2 * INST_SIZE; \
+  _clearFlags(); \
+  DISPATCH()
+#define FUSED_CMP(cond) FUSED_BRANCH(op_cmp, OPCODE_CMP, cond)
+#define FUSED_TST(cond) FUSED_BRANCH(op_tst, OPCODE_TST, cond)
+// Set a register to an immediate, then run an ALU instruction
+#define FUSED_MOVI(op) \
+  FUSE(op_movi); \
+  _registers[inst->reg1] = inst->argB; \
+  FUSED_ALU(op)
+
+  DISPATCH();
+
+ op_decode:
+  // The slot was written to since it was decoded
+  _decode(ip / INST_SIZE);
+  goto *dispatch[inst->handler];
+ op_nop:
+  NEXT();
+ op_input:
+  _registers[inst->reg1] = _io->getInput(_registers[inst->reg2]);
+  NEXT();
+ op_call:
+  _push(ip);
+  JUMP(inst->argA);
+ op_ret:
+  ip = (_pop() + INST_SIZE) & 0xfffc;
+  _registers[REG_SP] -= inst->arg1;
+  _clearFlags();
+  DISPATCH();
+ op_load:
+  _registers[inst->reg1] = _load(_registers[inst->reg2]);
+  NEXT();
+ op_loadi:
+  _registers[inst->reg1] = _load(inst->argB);
+  NEXT();
+ op_mov:
+  _registers[inst->reg1] = _registers[inst->reg2];
+  NEXT();
+ op_movi:
+  _registers[inst->reg1] = inst->argB;
+  NEXT();
+ op_push:
+  _push(_registers[inst->reg1]);
+  NEXT();
+ op_pop:
+  _registers[inst->reg1] = _pop();
+  NEXT();
+ op_add:
+  ALU(OPCODE_ADD);
+ op_sub:
+  ALU(OPCODE_SUB);
+ op_mul:
+  ALU(OPCODE_MUL);
+ op_div:
+  ALU(OPCODE_DIV);
+ op_and:
+  ALU(OPCODE_AND);
+ op_or:
+  ALU(OPCODE_OR);
+ op_xor:
+  ALU(OPCODE_XOR);
+ op_shl:
+  ALU(OPCODE_SHL);
+ op_shra:
+  ALU(OPCODE_SHRA);
+ op_shrl:
+  ALU(OPCODE_SHRL);
+ op_cmp:
+  ALU(OPCODE_CMP);
+ op_tst:
+  ALU(OPCODE_TST);
+ op_color:
+  _colorRegister = (uint8_t)_registers[inst->reg1];
+  NEXT();
+ op_pixel:
+  _vidMem->set(_registers[inst->reg1], _registers[inst->reg2],
+               _colorRegister);
+  NEXT();
+ op_stor:
+  _store(_registers[inst->reg2], _registers[inst->reg1]);
+  NEXT();
+ op_stori:
+  _store(inst->argB, _registers[inst->reg1]);
+  NEXT();
+ op_time:
+  // The budget has already been taken for this instruction
+  _registers[inst->reg1] =
+    _time(_instructionCount + (max_instructions - remaining) - 1);
+  NEXT();
+ op_timerst:
+  _resetTimer(_instructionCount + (max_instructions - remaining) - 1);
+  NEXT();
+ op_rnd:
+  _registers[inst->reg1] = _random();
+  NEXT();
+ op_jmp:
+  JUMP(_registers[inst->reg1] & 0xfffc);
+ op_jmpi:
+  JUMP(inst->argA);
+ op_jeq:
+  BRANCH(_zeroFlag());
+ op_jne:
+  BRANCH(!_zeroFlag());
+ op_jg:
+  BRANCH(!_zeroFlag() && _signFlag() == _overflowFlag());
+ op_jge:
+  BRANCH(_signFlag() == _overflowFlag());
+ op_ja:
+  BRANCH(!_carryFlag() && !_zeroFlag());
+ op_jae:
+  BRANCH(!_carryFlag());
+ op_jl:
+  BRANCH(_signFlag() != _overflowFlag());
+ op_jle:
+  BRANCH(_signFlag() != _overflowFlag() || _zeroFlag());
+ op_jb:
+  BRANCH(_carryFlag());
+ op_jbe:
+  BRANCH(_carryFlag() || _zeroFlag());
+ op_jo:
+  BRANCH(_overflowFlag());
+ op_jno:
+  BRANCH(!_overflowFlag());
+ op_js:
+  BRANCH(_signFlag());
+ op_jns:
+  BRANCH(!_signFlag());
+
+  // Fused pairs of instructions
+ op_cmp_jeq:
+  FUSED_CMP(_zeroFlag());
+ op_cmp_jne:
+  FUSED_CMP(!_zeroFlag());
+ op_cmp_jg:
+  FUSED_CMP(!_zeroFlag() && _signFlag() == _overflowFlag());
+ op_cmp_jge:
+  FUSED_CMP(_signFlag() == _overflowFlag());
+ op_cmp_ja:
+  FUSED_CMP(!_carryFlag() && !_zeroFlag());
+ op_cmp_jae:
+  FUSED_CMP(!_carryFlag());
+ op_cmp_jl:
+  FUSED_CMP(_signFlag() != _overflowFlag());
+ op_cmp_jle:
+  FUSED_CMP(_signFlag() != _overflowFlag() || _zeroFlag());
+ op_cmp_jb:
+  FUSED_CMP(_carryFlag());
+ op_cmp_jbe:
+  FUSED_CMP(_carryFlag() || _zeroFlag());
+ op_cmp_jo:
+  FUSED_CMP(_overflowFlag());
+ op_cmp_jno:
+  FUSED_CMP(!_overflowFlag());
+ op_cmp_js:
+  FUSED_CMP(_signFlag());
+ op_cmp_jns:
+  FUSED_CMP(!_signFlag());
+ op_tst_jeq:
+  FUSED_TST(_zeroFlag());
+ op_tst_jne:
+  FUSED_TST(!_zeroFlag());
+ op_tst_jg:
+  FUSED_TST(!_zeroFlag() && _signFlag() == _overflowFlag());
+ op_tst_jge:
+  FUSED_TST(_signFlag() == _overflowFlag());
+ op_tst_ja:
+  FUSED_TST(!_carryFlag() && !_zeroFlag());
+ op_tst_jae:
+  FUSED_TST(!_carryFlag());
+ op_tst_jl:
+  FUSED_TST(_signFlag() != _overflowFlag());
+ op_tst_jle:
+  FUSED_TST(_signFlag() != _overflowFlag() || _zeroFlag());
+ op_tst_jb:
+  FUSED_TST(_carryFlag());
+ op_tst_jbe:
+  FUSED_TST(_carryFlag() || _zeroFlag());
+ op_tst_jo:
+  FUSED_TST(_overflowFlag());
+ op_tst_jno:
+  FUSED_TST(!_overflowFlag());
+ op_tst_js:
+  FUSED_TST(_signFlag());
+ op_tst_jns:
+  FUSED_TST(!_signFlag());
+ op_movi_add:
+  FUSED_MOVI(OPCODE_ADD);
+ op_movi_sub:
+  FUSED_MOVI(OPCODE_SUB);
+ op_movi_mul:
+  FUSED_MOVI(OPCODE_MUL);
+ op_movi_and:
+  FUSED_MOVI(OPCODE_AND);
+ op_movi_or:
+  FUSED_MOVI(OPCODE_OR);
+ op_movi_xor:
+  FUSED_MOVI(OPCODE_XOR);
+ op_movi_shl:
+  FUSED_MOVI(OPCODE_SHL);
+ op_movi_shra:
+  FUSED_MOVI(OPCODE_SHRA);
+ op_movi_shrl:
+  FUSED_MOVI(OPCODE_SHRL);
+ op_movi_cmp:
+  FUSED_MOVI(OPCODE_CMP);
+ op_movi_tst:
+  FUSED_MOVI(OPCODE_TST);
+ op_load_add:
+  FUSE(op_load);
+  _registers[inst->reg1] = _load(_registers[inst->reg2]);
+  FUSED_ALU(OPCODE_ADD);
+ op_push_call:
+  FUSE(op_push);
+  _push(_registers[inst->reg1]);
+  ip += INST_SIZE;
+  if (OPCODE_DECODE == _decoded[ip / INST_SIZE].handler) {
+    // The push wrote over the call, so run whatever is there now
+    fused -= 2;
+    _clearFlags();
+    inst = &_decoded[ip / INST_SIZE];
+    goto op_decode;
+  }
+  _push(ip);
+  JUMP(inst->argA);
+ op_break:
+  // Stop before the instruction runs, and give it back to the budget
+  _debugger->stopAt(ip);
+  remaining++;
+  goto done;
+
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef BRANCH
+#undef ALU
+#undef FUSE
+#undef FUSED_ALU
+#undef FUSED_BRANCH
+#undef FUSED_CMP
+#undef FUSED_TST
+#undef FUSED_MOVI
+
+ done:
+  if (Traced) {
+    _tracer->endSlice(trace, _registers);
+  }
+  _instructionPointer = ip;
+  _instructionCount += max_instructions - remaining;
+  _threadedCount += max_instructions - remaining;
+  _fusedCount += fused;
+  return max_instructions - remaining;
+}
+
+template uint64_t EmuProcessor::_runThreaded<false>(const uint64_t&);
+template uint64_t EmuProcessor::_runThreaded<true>(const uint64_t&);
@@ -0,0 +1,110 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#include <stdio.h>
+#include <iostream>
+#include <string>
+#include <string.h>
+#include "isa.h"
+#include "tracer.h"
+
+// Turns a trace written by --trace back into text, one line per
+// instruction: the instruction number, its address, its mnemonic and
+// the register it wrote, if any, followed by SP for POP.
+
+// Reads the raw records of the trace a block at a time
+class TraceReader {
+ public:
+  TraceReader(FILE *file) : _file(file), _pos(0), _end(0), _partial(false) { }
+  bool record(uint64_t& out) {
+    if (_pos == _end) {
+      size_t n = fread(_buffer, 1, sizeof(_buffer), _file);
+      _end = n / sizeof(uint64_t);
+      _partial = 0 != n % sizeof(uint64_t);
+      _pos = 0;
+      if (0 == _end) {
+        return false;
+      }
+    }
+    out = _buffer[_pos++];
+    return true;
+  }
+  // Whether the trace ended partway through a record
+  bool partial() { return _partial; }
+
+ private:
+  FILE *_file;
+  uint64_t _buffer[TRACE_READ_SIZE];
+  size_t _pos;
+  size_t _end;
+  bool _partial;
+};
+
+int main(int argc, char **argv) {
+  if (2 != argc) {
+    std::cerr << "Usage: " << argv[0] << " TRACE" << std::endl;
+    return 1;
+  }
+  FILE *file = fopen(argv[1], "rb");
+  EmuTraceHeader header;
+  if (nullptr == file ||
+      1 != fread(&header, sizeof(header), 1, file) ||
+      0 != memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) ||
+      TRACE_VERSION != header.version) {
+    std::cerr << "Error: '" << argv[1] << "' is not a trace from this "
+              << "version of the emulator." << std::endl;
+    if (nullptr != file) {
+      fclose(file);
+    }
+    return 1;
+  }
+
+  // Each record carries the registers after the instruction before it,
+  // so an instruction is only printed once the next record is in. The
+  // records that end a slice carry nothing else.
+  TraceReader *reader = new TraceReader(file);
+  uint64_t count = header.instructionCount;
+  bool held = false;
+  uint16_t heldIp = 0;
+  uint8_t heldOpcode = 0;
+  uint8_t heldReg1 = 0;
+  uint64_t raw;
+  char line[64];
+  while (reader->record(raw)) {
+    if (held) {
+      // Every register written other than the first operand is SP
+      uint16_t value = raw >> 32;
+      uint16_t sp = raw >> 48;
+      const EmuOpcodeInfo& info = EMU_ISA[heldOpcode & 0x3f];
+      uint8_t reg = ISA_WRITES_REG1 == info.writes ? heldReg1 : info.writes;
+      if (ISA_WRITES_NONE == reg) {
+        snprintf(line, sizeof(line), "%llu %04x %s",
+                 (unsigned long long)count++, heldIp, info.mnemonic);
+      } else if (OPCODE_POP == (heldOpcode & 0x3f) && REG_SP != reg) {
+        snprintf(line, sizeof(line), "%llu %04x %-7s %s=0x%04x %s=0x%04x",
+                 (unsigned long long)count++, heldIp, info.mnemonic,
+                 EMU_REGISTERS[reg], value, EMU_REGISTERS[REG_SP], sp);
+      } else {
+        snprintf(line, sizeof(line), "%llu %04x %-7s %s=0x%04x",
+                 (unsigned long long)count++, heldIp, info.mnemonic,
+                 EMU_REGISTERS[reg], REG_SP == reg ? sp : value);
+      }
+      puts(line);
+    }
+    held = TRACE_SLICE_END != (uint8_t)(raw >> 16);
+    heldIp = raw;
+    heldOpcode = raw >> 16;
+    heldReg1 = (raw >> 24) & 0xf;
+  }
+  bool partial = reader->partial();
+  delete reader;
+  fclose(file);
+  if (held || partial) {
+    std::cerr << "Error: The trace ends partway through an instruction."
+              << std::endl;
+    return 1;
+  }
+  return 0;
+}
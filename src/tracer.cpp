@@ -0,0 +1,141 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <iostream>
+#include <string.h>
+#include "tracer.h"
+
+EmuTracer::EmuTracer(const std::string& trace_filename)
+                    : _filename(trace_filename),
+                      _fd(-1),
+                      _error(false),
+                      _chunks(nullptr),
+                      _cursor(),
+                      _current(0),
+                      _sliceEnds(0),
+                      _filled(0),
+                      _drained(0),
+                      _stopping(false),
+                      _writeFailed(false),
+                      _records(0),
+                      _bytes(0) {
+  _fd = open(trace_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (-1 == _fd) {
+    std::cerr << "Error: Failed to open trace file '"
+              << trace_filename << "'." << std::endl;
+    _error = true;
+    return;
+  }
+  _chunks = new uint64_t[TRACE_NUM_CHUNKS * TRACE_CHUNK_RECORDS];
+  _cursor.next = _chunks;
+  _cursor.end = _chunks + TRACE_CHUNK_RECORDS;
+  _writer = std::thread(&EmuTracer::_writerLoop, this);
+}
+
+EmuTracer::~EmuTracer() {
+  finish();
+  delete[] _chunks;
+}
+
+void EmuTracer::begin(const uint64_t& instruction_count) {
+  // Nothing has been handed to the writer yet, so the header can be
+  // written from here without getting in its way
+  EmuTraceHeader header;
+  memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  header.version = TRACE_VERSION;
+  header.reserved = 0;
+  header.instructionCount = instruction_count;
+  _write(&header, sizeof(header));
+}
+
+bool EmuTracer::finish() {
+  if (_writer.joinable()) {
+    _handOff(_cursor);
+    _stopping.store(true, std::memory_order_release);
+    _writer.join();
+  }
+  if (-1 != _fd) {
+    if (0 != close(_fd)) {
+      _writeFailed = true;
+    }
+    _fd = -1;
+    if (_writeFailed) {
+      std::cerr << "Error: Failed to write trace file '"
+                << _filename << "'." << std::endl;
+    }
+  }
+  return !_error && !_writeFailed;
+}
+
+void EmuTracer::report(std::ostream& out) {
+  // Slice ends go out as records too, but aren't instructions
+  uint64_t records = _records - _sliceEnds;
+  out << "Trace: " << records << " instructions, " << _bytes << " bytes";
+  if (0 < records) {
+    out << " (" << (double)_bytes / records << " per instruction)";
+  }
+  out << std::endl;
+}
+
+void EmuTracer::_handOff(EmuTraceCursor& cursor) {
+  // Give the chunk to the writer and move on to the next one, waiting
+  // for the writer to free it up if every chunk is still queued
+  _lengths[_current % TRACE_NUM_CHUNKS] =
+    TRACE_CHUNK_RECORDS - (cursor.end - cursor.next);
+  _current++;
+  _filled.store(_current, std::memory_order_release);
+  while (TRACE_NUM_CHUNKS <=
+         _current - _drained.load(std::memory_order_acquire)) {
+    std::this_thread::sleep_for(
+      std::chrono::microseconds(TRACE_WAIT_MICROS));
+  }
+  cursor.next = _chunks + (_current % TRACE_NUM_CHUNKS) * TRACE_CHUNK_RECORDS;
+  cursor.end = cursor.next + TRACE_CHUNK_RECORDS;
+}
+
+void EmuTracer::_writerLoop() {
+  while (true) {
+    uint32_t drained = _drained.load(std::memory_order_relaxed);
+    if (drained == _filled.load(std::memory_order_acquire)) {
+      if (_stopping.load(std::memory_order_acquire) &&
+          drained == _filled.load(std::memory_order_acquire)) {
+        break;
+      }
+      std::this_thread::sleep_for(
+        std::chrono::microseconds(TRACE_WAIT_MICROS));
+      continue;
+    }
+    // The chunk is written straight from the ring, so it is only
+    // handed back once the write is done
+    uint32_t length = _lengths[drained % TRACE_NUM_CHUNKS];
+    _write(_chunks + (drained % TRACE_NUM_CHUNKS) * TRACE_CHUNK_RECORDS,
+           length * sizeof(uint64_t));
+    _records += length;
+    _drained.store(drained + 1, std::memory_order_release);
+  }
+}
+
+bool EmuTracer::_write(const void *data, const size_t& length) {
+  // Once a write has failed, chunks are still taken off the ring so
+  // the processor never backs up, but they go nowhere
+  const uint8_t *bytes = (const uint8_t *)data;
+  size_t done = 0;
+  while (!_writeFailed && done < length) {
+    ssize_t n = write(_fd, bytes + done, length - done);
+    if (n < 0 && EINTR == errno) {
+      continue;
+    } else if (n < 0) {
+      _writeFailed = true;
+      break;
+    }
+    done += n;
+  }
+  _bytes += length;
+  return !_writeFailed;
+}
@@ -0,0 +1,117 @@
+/**
+ * Consolite Emulator
+ * Copyright (c) 2015 Robert Fotino, All Rights Reserved
+ */
+
+#ifndef EMU_TRACER_H
+#define EMU_TRACER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <ostream>
+#include <string>
+#include <thread>
+#include "defs.h"
+
+// The start of a trace file, in the byte order of the host. It is
+// followed by the raw records of EmuTracer::step(), also in the byte
+// order of the host, which emu-tracedump turns back into text.
+struct EmuTraceHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  // The instruction count when the trace started
+  uint64_t instructionCount;
+};
+
+// Stands in for the opcode of the raw record that ends a slice, which
+// stands for no instruction itself
+#define TRACE_SLICE_END 0xff
+
+// Where the processor is in the chunk it is filling. It is kept in a
+// local while the processor runs, so that recording an instruction
+// touches no memory but the record itself.
+struct EmuTraceCursor {
+  uint64_t *next;
+  uint64_t *end;
+  // The first register operand of the last instruction, whose value
+  // goes out with the next record
+  uint8_t lastReg;
+};
+
+// Records every instruction the threaded engine runs to a file. The
+// processor thread only stores a fixed size raw record per instruction
+// into a ring of chunks; a writer thread puts each full chunk out as it
+// is with a single write(), so that neither side spends time encoding
+// it. If the disk can't keep up, the processor waits rather than lose
+// part of the trace.
+class EmuTracer {
+ public:
+  EmuTracer(const std::string& trace_filename);
+  ~EmuTracer();
+  bool hasError() { return _error; }
+  // Writes the header, once the processor is ready to run
+  void begin(const uint64_t& instruction_count);
+  // Picks up where the last slice left off
+  EmuTraceCursor resume() { return _cursor; }
+  // Raw records hold the address in the low 16 bits, then the opcode,
+  // then the first register operand, then the value of the first
+  // register operand of the instruction before, then SP. Registers can
+  // only be read once the instruction has run, so they go out with the
+  // record of the next one, and which of them it actually wrote is left
+  // for emu-tracedump to work out from the opcode.
+  void step(EmuTraceCursor& cursor, const uint16_t& ip,
+            const uint8_t& opcode, const uint8_t& reg1,
+            const uint16_t *registers) {
+    *cursor.next++ = ip | (uint32_t)opcode << 16 | (uint32_t)reg1 << 24 |
+                     (uint64_t)registers[cursor.lastReg] << 32 |
+                     (uint64_t)registers[REG_SP] << 48;
+    cursor.lastReg = reg1;
+    if (cursor.end == cursor.next) {
+      _handOff(cursor);
+    }
+  }
+  // Records the registers written by the last instruction, once the
+  // processor stops running, and keeps the cursor for the next slice
+  void endSlice(EmuTraceCursor& cursor, const uint16_t *registers) {
+    _sliceEnds++;
+    step(cursor, 0, TRACE_SLICE_END, 0, registers);
+    _cursor = cursor;
+  }
+  // Hands the last chunk to the writer and waits for it to finish,
+  // returning whether the whole trace made it to the file
+  bool finish();
+  void report(std::ostream& out);
+
+ private:
+  void _handOff(EmuTraceCursor& cursor);
+  void _writerLoop();
+  bool _write(const void *data, const size_t& length);
+
+  std::string _filename;
+  int _fd;
+  bool _error;
+  uint64_t *_chunks;
+  uint32_t _lengths[TRACE_NUM_CHUNKS];
+  // Processor side: where the last slice stopped, and the chunk being
+  // filled
+  EmuTraceCursor _cursor;
+  uint32_t _current;
+  // The records that end a slice and stand for no instruction
+  uint64_t _sliceEnds;
+  // Chunks handed to the writer and written by it, padded onto cache
+  // lines of their own
+  uint8_t _processorPadding[CACHE_LINE_SIZE];
+  std::atomic<uint32_t> _filled;
+  uint8_t _filledPadding[CACHE_LINE_SIZE];
+  std::atomic<uint32_t> _drained;
+  uint8_t _drainedPadding[CACHE_LINE_SIZE];
+  std::atomic<bool> _stopping;
+  std::atomic<bool> _writeFailed;
+  // Writer side: the records and bytes written so far
+  uint64_t _records;
+  uint64_t _bytes;
+  std::thread _writer;
+};
+
+#endif
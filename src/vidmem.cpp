@@ -6,30 +6,99 @@
 #include <string.h>
 #include "vidmem.h"
 
-EmuVideoMemory::EmuVideoMemory() {
-  _buffer = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
-                                       getWidth(),
-                                       getHeight());
-  _cairo = cairo_create(_buffer);
+EmuVideoMemory::EmuVideoMemory() : _generation(1),
+                                   _pixelWrites(0),
+                                   _publishedFrames(0),
+                                   _dirty(false),
+                                   _back(0),
+                                   _front(1),
+                                   _shared(2),
+                                   _frameRequested(false) {
+  memset(_data, 0, sizeof(_data));
+  memset(_rowStamps, 0, sizeof(_rowStamps));
+  memset(_frames, 0, sizeof(_frames));
 }
 
-EmuVideoMemory::~EmuVideoMemory() {
-  cairo_destroy(_cairo);
-  cairo_surface_destroy(_buffer);
+void EmuVideoMemory::_publish() {
+  // Bring the back frame buffer up to date by copying the rows that
+  // were written since it was last published
+  Frame& frame = _frames[_back];
+  for (int y = 0; y < VIDEO_HEIGHT; y++) {
+    if (_rowStamps[y] > frame.generation) {
+      memcpy(frame.data + (y * VIDEO_WIDTH), _data + (y * VIDEO_WIDTH),
+             VIDEO_WIDTH);
+      frame.rowStamps[y] = _rowStamps[y];
+    }
+  }
+  frame.generation = _generation++;
+  _publishedFrames++;
+  _dirty = false;
+  _frameRequested.store(false, std::memory_order_relaxed);
+  // Swap it with the shared frame buffer, which may be a frame the
+  // presenter never got around to acquiring
+  _back = _shared.exchange(_back | VIDEO_FRAME_NEW,
+                           std::memory_order_acq_rel) & ~VIDEO_FRAME_NEW;
 }
 
-void EmuVideoMemory::set(const uint8_t& x,
-                         const uint8_t& y,
-                         const uint8_t& color) {
+void EmuVideoMemory::saveState(uint8_t *dest) {
+  memcpy(dest, _data, sizeof(_data));
+}
+
+void EmuVideoMemory::loadState(const uint8_t *src) {
+  // Every row may have changed, so all of them need publishing
+  memcpy(_data, src, sizeof(_data));
+  for (int y = 0; y < VIDEO_HEIGHT; y++) {
+    _rowStamps[y] = _generation;
+  }
+  _dirty = true;
+}
+
+bool EmuVideoMemory::acquireFrame() {
+  // Take the newest published frame, if there is one
+  if (!(_shared.load(std::memory_order_relaxed) & VIDEO_FRAME_NEW)) {
+    return false;
+  }
+  _front = _shared.exchange(_front, std::memory_order_acq_rel) &
+           ~VIDEO_FRAME_NEW;
+  return true;
+}
+
+uint32_t EmuVideoMemory::toRGB(const uint8_t& color) {
   // Decode the color. The most significant three bits represent
   // red, the middle three bits represent green, and the lowest
-  // two bits represent blue. We want the color as a double from
-  // 0.0 to 1.0 for cairo.
-  double red = (color & 0xe0) / 255.0;
-  double green = ((color & 0x1c) << 3) / 255.0;
-  double blue = ((color & 0x3) << 6) / 255.0;
-  // Paint the pixel specified by (x, y) to the buffer
-  cairo_set_source_rgb(_cairo, red, green, blue);
-  cairo_rectangle(_cairo, x, y, 1, 1);
-  cairo_fill(_cairo);
+  // two bits represent blue. Each component ends up in its own
+  // byte of a 0x00RRGGBB pixel.
+  uint32_t red = color & 0xe0;
+  uint32_t green = (color & 0x1c) << 3;
+  uint32_t blue = (color & 0x3) << 6;
+  return (red << 16) | (green << 8) | blue;
+}
+
+void EmuVideoMemory::convert(uint32_t *dest, const int& stride) {
+  convertRows(dest, stride, 0, VIDEO_HEIGHT);
+}
+
+void EmuVideoMemory::convertRows(uint32_t *dest, const int& stride,
+                                 const int& first_row, const int& num_rows) {
+  // Expand rows of the acquired 8-bit frame into 32-bit pixels,
+  // where dest is the whole frame and stride is the distance in
+  // bytes between rows of the destination.
+  const uint8_t *src = _frames[_front].data + (first_row * VIDEO_WIDTH);
+  for (int y = first_row; y < first_row + num_rows; y++) {
+    uint32_t *row = (uint32_t *)((uint8_t *)dest + (y * stride));
+    for (int x = 0; x < VIDEO_WIDTH; x++) {
+      row[x] = toRGB(src[x]);
+    }
+    src += VIDEO_WIDTH;
+  }
+}
+
+uint64_t EmuVideoMemory::hash() {
+  // 64-bit FNV-1a over the raw 8-bit video memory
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (int i = 0; i < VIDEO_MEMORY_SIZE; i++) {
+    h ^= _data[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
 }
@@ -6,25 +6,92 @@
 #ifndef EMU_VIDMEM_H
 #define EMU_VIDMEM_H
 
-#include <cairo/cairo.h>
 #include <stdint.h>
+#include <atomic>
 #include "defs.h"
 
+// Video memory is written by the processor thread and presented by
+// the window thread. The processor draws into its own back buffer,
+// and hands finished frames to the presenter through three frame
+// buffers that are swapped with a single atomic exchange, so neither
+// thread ever waits for the other and PIXEL stays free of atomics.
 class EmuVideoMemory {
+  friend class EmuJit;
+
  public:
   EmuVideoMemory();
-  ~EmuVideoMemory();
 
-  void initImage(cairo_surface_t *window_surface);
   int getWidth() { return VIDEO_WIDTH; }
   int getHeight() { return VIDEO_HEIGHT; }
-  cairo_surface_t *getBuffer() { return _buffer; }
 
-  void set(const uint8_t& x, const uint8_t& y, const uint8_t& color);
+  // Processor side
+  const uint8_t *getData() { return _data; }
+  void set(const uint8_t& x, const uint8_t& y, const uint8_t& color) {
+    _pixelWrites++;
+    // Rows past the bottom of the screen are not backed by video memory
+    if (y < VIDEO_HEIGHT) {
+      _data[(y * VIDEO_WIDTH) + x] = color;
+      _rowStamps[y] = _generation;
+      _dirty = true;
+    }
+  }
+  void publishIfRequested() {
+    if (_dirty && _frameRequested.load(std::memory_order_relaxed)) {
+      _publish();
+    }
+  }
+  // PIXEL instructions run, and frames published, for telemetry
+  uint64_t getPixelWrites() { return _pixelWrites; }
+  uint64_t getPublishedFrames() { return _publishedFrames; }
+  // Starts a new generation without publishing, so that rows written
+  // from now on can be told apart from the ones before, and returns it
+  uint32_t mark() { return ++_generation; }
+  uint32_t getRowStamp(const int& y) { return _rowStamps[y]; }
+  uint64_t hash();
+  void saveState(uint8_t *dest);
+  void loadState(const uint8_t *src);
+
+  // Presenter side
+  bool acquireFrame();
+  void requestFrame() {
+    _frameRequested.store(true, std::memory_order_relaxed);
+  }
+  // Every row is stamped with the generation it was last written in,
+  // and each published frame with the generation it ended, so the
+  // presenter can tell which rows changed between two frames
+  uint32_t getFrameGeneration() { return _frames[_front].generation; }
+  const uint8_t *getFrameData() { return _frames[_front].data; }
+  uint32_t getFrameRowStamp(const int& y) {
+    return _frames[_front].rowStamps[y];
+  }
+  void convert(uint32_t *dest, const int& stride);
+  void convertRows(uint32_t *dest, const int& stride,
+                   const int& first_row, const int& num_rows);
+
+  static uint32_t toRGB(const uint8_t& color);
 
  private:
-  cairo_surface_t *_buffer;
-  cairo_t *_cairo;
+  struct Frame {
+    uint8_t data[VIDEO_MEMORY_SIZE];
+    uint32_t rowStamps[VIDEO_HEIGHT];
+    uint32_t generation;
+  };
+  void _publish();
+
+  uint8_t _data[VIDEO_MEMORY_SIZE];
+  uint32_t _rowStamps[VIDEO_HEIGHT];
+  uint32_t _generation;
+  uint64_t _pixelWrites;
+  uint64_t _publishedFrames;
+  bool _dirty;
+  Frame _frames[3];
+  // Owned by the processor and presenter threads respectively
+  int _back;
+  int _front;
+  // The frame buffer in between, with VIDEO_FRAME_NEW set if it
+  // holds a frame that the presenter has not acquired yet
+  std::atomic<int> _shared;
+  std::atomic<bool> _frameRequested;
 };
 
 #endif
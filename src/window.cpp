@@ -4,17 +4,36 @@
  */
 
 #include <X11/XKBlib.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <chrono>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include "window.h"
+#include "cairopresenter.h"
+#include "shmpresenter.h"
 
 EmuWindow::EmuWindow(EmuVideoMemory *vid_mem,
-                     const std::string& keymap_filename)
-                    : _vidMem(vid_mem),
+                     const std::string& keymap_filename,
+                     const EmuPresentMode& present_mode)
+                    : _presenter(nullptr),
+                      _recorder(nullptr),
+                      _rewind(nullptr),
+                      _telemetry(nullptr),
+                      _display(nullptr),
+                      _window(0),
+                      _overlayGC(nullptr),
+                      _vidMem(vid_mem),
+                      _drawnGeneration(0),
+                      _refreshRate(DEFAULT_REFRESH_RATE),
+                      _frameTicks(0),
+                      _missedDeadlines(0),
                       _error(false),
                       _width(DEFAULT_WINDOW_WIDTH),
-                      _height(DEFAULT_WINDOW_HEIGHT) {
+                      _height(DEFAULT_WINDOW_HEIGHT),
+                      _rewindKeycode(0) {
   // Read key mapping into memory
   _loadKeyMap(keymap_filename);
 
@@ -40,25 +59,30 @@ EmuWindow::EmuWindow(EmuVideoMemory *vid_mem,
       BlackPixel(_display, screen_num), // Border color
       BlackPixel(_display, screen_num)  // Background color
   );
+  _window = window;
 
-  // Create the cairo surface we will use for drawing to the window
+  // Set up presenting frames to the window, through shared memory
+  // if we can and cairo if we can't
   Visual *visual = DefaultVisual(_display, screen_num);
-  _surface = cairo_xlib_surface_create(
-      _display,     // Connection to the X server
-      window,       // A Drawable, the window in this case
-      visual,       // A Visual, the screen in this case
-      _width,       // The surface width
-      _height       // The surface height
-  );
-  if (nullptr == _surface) {
+  if (PRESENT_CAIRO != present_mode) {
+    EmuShmPresenter *shm = new EmuShmPresenter(
+        _display, window, visual, DefaultDepth(_display, screen_num),
+        _width, _height);
+    if (shm->hasError()) {
+      delete shm;
+      if (PRESENT_SHM == present_mode) {
+        std::cerr << "Warning: MIT-SHM is not available, presenting "
+                  << "with cairo instead." << std::endl;
+      }
+    } else {
+      _usePresenter(shm);
+    }
+  }
+  if (nullptr == _presenter && !_createCairoPresenter()) {
     _error = true;
-    std::cerr << "Error: Cannot get cairo Xlib surface." << std::endl;
     return;
   }
 
-  // Create the cairo object from the window surface
-  _cairo = cairo_create(_surface);
-  
   // Intercept the WM_DELETE_WINDOW message from the window
   // manager so that we can close the window when the user hits
   // the exit button.
@@ -72,17 +96,49 @@ EmuWindow::EmuWindow(EmuVideoMemory *vid_mem,
   XMapWindow(_display, window);
   // Suppress auto-repeating KeyRelease events
   XkbSetDetectableAutoRepeat(_display, 1, 0);
+  // Work out which keycodes the key map refers to
+  _resolveKeyMap();
   // Flush any buffered commands to the X server
   XFlush(_display);
 }
 
 EmuWindow::~EmuWindow() {
-  // Destroy the cairo object
-  cairo_destroy(_cairo);
-  // Destroy the cairo Xlib surface
-  cairo_surface_destroy(_surface);
+  // Destroy the presenter and overlay before the connection they use
+  delete _presenter;
+  if (nullptr != _overlayGC) {
+    XFreeGC(_display, _overlayGC);
+  }
   // Close the connection to the X server
-  XCloseDisplay(_display);
+  if (nullptr != _display) {
+    XCloseDisplay(_display);
+  }
+}
+
+void EmuWindow::setTelemetry(EmuTelemetry *telemetry, const bool& overlay) {
+  _telemetry = telemetry;
+  if (overlay && nullptr == _overlayGC) {
+    int screen_num = DefaultScreen(_display);
+    _overlayGC = XCreateGC(_display, _window, 0, nullptr);
+    XSetForeground(_display, _overlayGC, WhitePixel(_display, screen_num));
+    XSetBackground(_display, _overlayGC, BlackPixel(_display, screen_num));
+  }
+}
+
+void EmuWindow::reportPresentTiming(std::ostream& out) {
+  if (nullptr == _presenter) {
+    return;
+  }
+  for (const EmuPresentTiming& timing : _presentTimings) {
+    out << "Present: " << timing.presenter << ", " << timing.count
+        << " frames";
+    if (0 < timing.count) {
+      out << ", " << timing.nanos / timing.count / 1000.0
+          << "us average, " << timing.maxNanos / 1000.0 << "us max";
+    }
+    out << std::endl;
+  }
+  out << "Refresh: " << _refreshRate << " Hz, " << _frameTicks
+      << " frame deadlines, " << _missedDeadlines << " missed" << std::endl;
 }
 
 void EmuWindow::_loadKeyMap(const std::string& keymap_filename) {
@@ -115,40 +171,85 @@ void EmuWindow::_loadKeyMap(const std::string& keymap_filename) {
   }
 }
 
-void EmuWindow::_draw() {
-  // Scale and paint the video memory's buffer to the window
-  double scaleX = (double)_width / _vidMem->getWidth();
-  double scaleY = (double)_height / _vidMem->getHeight();
-  cairo_identity_matrix(_cairo);
-  cairo_scale(_cairo, scaleX, scaleY);
-  cairo_set_source_surface(_cairo, _vidMem->getBuffer(), 0, 0);
-  cairo_pattern_set_filter(cairo_get_source(_cairo), CAIRO_FILTER_NEAREST);
-  cairo_paint(_cairo);
-  cairo_surface_flush(_surface);
-  XFlush(_display);
+void EmuWindow::_draw(const bool& full) {
+  // Ask the processor for another frame, and draw the rows that
+  // changed in the newest one it has published, or all of them
+  bool fresh = _vidMem->acquireFrame();
+  _vidMem->requestFrame();
+  if (!fresh && !full) {
+    // Nothing changed, so there is nothing to present
+    return;
+  }
+  uint32_t since = _drawnGeneration;
+  _drawnGeneration = _vidMem->getFrameGeneration();
+  _damage.clear();
+  int height = _vidMem->getHeight();
+  int y = 0;
+  while (y < height) {
+    if (!full && _vidMem->getFrameRowStamp(y) <= since) {
+      y++;
+      continue;
+    }
+    EmuDamage rows;
+    rows.firstRow = y;
+    while (y < height && (full || _vidMem->getFrameRowStamp(y) > since)) {
+      y++;
+    }
+    rows.numRows = y - rows.firstRow;
+    _damage.push_back(rows);
+  }
+  if (_damage.empty()) {
+    return;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  _presenter->present(_vidMem, _damage);
+  uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start).count();
+  EmuPresentTiming& timing = _presentTimings.back();
+  timing.count++;
+  timing.nanos += nanos;
+  if (timing.maxNanos < nanos) {
+    timing.maxNanos = nanos;
+  }
+  if (nullptr != _telemetry) {
+    _telemetry->presented(nanos);
+  }
 }
 
-void EmuWindow::setPixel(const uint8_t& x,
-                         const uint8_t& y,
-                         const uint8_t& color) {
-  // Set the pixel's value in video memory
-  _vidMem->set(x, y, color);
+void EmuWindow::_drawOverlay() {
+  // Draw over the top left of the frame on every tick, since the
+  // presenter may have just drawn the rows underneath
+  std::string text = _telemetry->getOverlayText();
+  if (!text.empty()) {
+    XDrawImageString(_display, _window, _overlayGC, TELEMETRY_OVERLAY_X,
+                     TELEMETRY_OVERLAY_Y, text.c_str(), text.size());
+  }
 }
 
-uint16_t EmuWindow::getInput(const uint16_t& input_id) {
-  // Return current input status. If this input_id is
-  // not registered to a key or button, return 0.
-  auto keySymPtr = _keyMap.find(input_id);
-  if (_keyMap.end() == keySymPtr) {
-    // This input isn't mapped to anything.
-    return 0;
+void EmuWindow::_resolveKeyMap() {
+  // Look up the keysym of every keycode once, so that key events can
+  // go straight from their keycode to the input IDs mapped to it
+  for (int i = 0; i < NUM_KEYCODES; i++) {
+    _keycodeInputs[i].clear();
   }
-  auto statePtr = _keyState.find(keySymPtr->second);
-  if (_keyState.end() == statePtr) {
-    // This key hasn't been pressed or released.
-    return 0;
+  int minKeycode, maxKeycode;
+  XDisplayKeycodes(_display, &minKeycode, &maxKeycode);
+  int keysymsPerKeycode;
+  KeySym *keysyms = XGetKeyboardMapping(_display,
+                                        minKeycode,
+                                        maxKeycode - minKeycode + 1,
+                                        &keysymsPerKeycode);
+  for (int keycode = minKeycode; keycode <= maxKeycode; keycode++) {
+    KeySym keysym = keysyms[(keycode - minKeycode) * keysymsPerKeycode];
+    for (auto& entry : _keyMap) {
+      if (entry.second == keysym) {
+        _keycodeInputs[keycode].push_back(entry.first);
+      }
+    }
   }
-  return statePtr->second;
+  XFree(keysyms);
+  _rewindKeycode = XKeysymToKeycode(_display, XStringToKeysym(REWIND_KEY));
 }
 
 void EmuWindow::_updateKeyState(const XKeyEvent& event) {
@@ -165,69 +266,160 @@ void EmuWindow::_updateKeyState(const XKeyEvent& event) {
       return;
     }
   }
-  int keysyms_per_keycode_return;
-  KeySym *keysym = XGetKeyboardMapping(_display,
-                                       event.keycode,
-                                       1,
-                                       &keysyms_per_keycode_return);
+  if (nullptr != _rewind && _rewindKeycode == event.keycode) {
+    // The rewind key belongs to the emulator rather than the game
+    if (KeyPress == event.type) {
+      _rewind->press();
+    } else {
+      _rewind->release();
+    }
+    return;
+  }
   uint16_t status = KeyPress == event.type ? 1 : 0;
-  _keyState[keysym[0]] = status;
-  XFree(keysym);
+  for (uint16_t inputId : _keycodeInputs[event.keycode & 0xff]) {
+    _inputs.set(inputId, status);
+  }
+}
+
+void EmuWindow::_usePresenter(EmuPresenter *presenter) {
+  // Frames are timed separately for each presenter, so that a fallback
+  // partway through a run doesn't mix them up
+  _presenter = presenter;
+  EmuPresentTiming timing;
+  timing.presenter = presenter->getName();
+  timing.count = 0;
+  timing.nanos = 0;
+  timing.maxNanos = 0;
+  _presentTimings.push_back(timing);
+}
+
+bool EmuWindow::_createCairoPresenter() {
+  EmuCairoPresenter *cairo = new EmuCairoPresenter(
+      _display, _window, DefaultVisual(_display, DefaultScreen(_display)),
+      _width, _height);
+  if (cairo->hasError()) {
+    delete cairo;
+    std::cerr << "Error: Cannot get cairo Xlib surface." << std::endl;
+    return false;
+  }
+  _usePresenter(cairo);
+  return true;
 }
 
 void EmuWindow::eventLoop() {
-  // Get the file descriptor for the connection to the X server,
-  // so that we can listen for input on a timer instead of blocking
-  // indefinitely on XNextEvent. The reason for this is we need to wake
-  // up every 1/60 of a second to repaint.
+  // Frames are presented on a fixed cadence set by a periodic timer
+  // with an absolute start, so that the frame rate does not drift and
+  // no amount of X events can hold a frame back. Events just update
+  // state, and anything they need redrawn waits for the next tick.
   int x11_fd = ConnectionNumber(_display);
-  fd_set event_fds;
-  struct timeval timer;
+  int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (-1 == timer_fd) {
+    std::cerr << "Error: Cannot create the frame timer." << std::endl;
+    return;
+  }
+  long period = 1000000000L / _refreshRate;
+  struct itimerspec timer;
+  clock_gettime(CLOCK_MONOTONIC, &timer.it_value);
+  timer.it_interval.tv_sec = period / 1000000000L;
+  timer.it_interval.tv_nsec = period % 1000000000L;
+  timer.it_value.tv_nsec += period;
+  timer.it_value.tv_sec += timer.it_value.tv_nsec / 1000000000L;
+  timer.it_value.tv_nsec %= 1000000000L;
+  timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &timer, nullptr);
+
+  struct pollfd fds[2];
+  fds[0].fd = x11_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = timer_fd;
+  fds[1].events = POLLIN;
   // The running variable is set to false when the user
   // closes the window, which breaks out of the event loop.
   bool running = true;
+  bool full = true;
   while (running) {
-    // Set up the set of file descriptors for select()
-    FD_ZERO(&event_fds);
-    FD_SET(x11_fd, &event_fds);
-    // Set timer to 1/60 of a second
-    timer.tv_usec = 16667;
-    timer.tv_sec = 0;
-    if (0 == select(x11_fd + 1, &event_fds, 0, 0, &timer)) {
-      // Timer expired
-      _draw();
+    // Handle the events that Xlib has already read off the socket
+    // before waiting, since poll() can't see those
+    while (running && XPending(_display)) {
+      XEvent event;
+      XNextEvent(_display, &event);
+      _handleEvent(event, running, full);
+    }
+    XFlush(_display);
+    if (!running || -1 == poll(fds, 2, -1)) {
       continue;
     }
-    // We received an event so handle it here
-    XEvent event;
-    XNextEvent(_display, &event);
-    switch (event.type) {
-    case KeyPress:
-    case KeyRelease:
-      _updateKeyState(event.xkey);
-      break;
-    case Expose:
-      // Draw to the window
-      _draw();
-      break;
-    case ConfigureNotify:
-      // The window was resized, redraw scaled
-      if (event.xconfigure.width != _width ||
-          event.xconfigure.height != _height) {
-        _width = event.xconfigure.width;
-        _height = event.xconfigure.height;
-        cairo_xlib_surface_set_size(_surface, _width, _height);
-        _draw();
+    uint64_t expirations;
+    if ((fds[1].revents & POLLIN) &&
+        sizeof(expirations) == read(timer_fd, &expirations,
+                                    sizeof(expirations))) {
+      // More than one expiration means we missed frame deadlines
+      _frameTicks += expirations;
+      _missedDeadlines += expirations - 1;
+      _draw(full);
+      full = false;
+      if (nullptr != _telemetry) {
+        _telemetry->skipped(expirations - 1);
+        if (nullptr != _overlayGC) {
+          _drawOverlay();
+        }
       }
-      break;
-    case ClientMessage:
-      // Hit the exit button
-      if ((unsigned)event.xclient.data.l[0] == _wmDeleteMessage) {
-        running = false;
+      if (nullptr != _recorder) {
+        // The frame stands in for the deadlines that were missed too,
+        // so the video keeps to real time
+        for (uint64_t i = 0; i < expirations; i++) {
+          _recorder->pushFrame(_vidMem->getFrameData());
+        }
       }
-      break;
-    default:
-      break;
     }
   }
+  close(timer_fd);
+}
+
+void EmuWindow::_handleEvent(XEvent& event, bool& running, bool& full) {
+  switch (event.type) {
+  case KeyPress:
+  case KeyRelease:
+    _updateKeyState(event.xkey);
+    if (nullptr != _telemetry) {
+      _telemetry->inputHandled();
+    }
+    break;
+  case Expose:
+    // Draw the whole window on the next frame
+    full = true;
+    break;
+  case ConfigureNotify:
+    // The window was resized, redraw scaled
+    if (event.xconfigure.width != _width ||
+        event.xconfigure.height != _height) {
+      _width = event.xconfigure.width;
+      _height = event.xconfigure.height;
+      if (!_presenter->resize(_width, _height)) {
+        // Fall back to cairo, as when the window was opened
+        std::cerr << "Warning: Cannot present with " << _presenter->getName()
+                  << " at the new size, presenting with cairo instead."
+                  << std::endl;
+        delete _presenter;
+        _presenter = nullptr;
+        if (!_createCairoPresenter()) {
+          running = false;
+        }
+      }
+      full = true;
+    }
+    break;
+  case MappingNotify:
+    // The keyboard layout changed, so keycodes need resolving again
+    XRefreshKeyboardMapping(&event.xmapping);
+    _resolveKeyMap();
+    break;
+  case ClientMessage:
+    // Hit the exit button
+    if ((unsigned)event.xclient.data.l[0] == _wmDeleteMessage) {
+      running = false;
+    }
+    break;
+  default:
+    break;
+  }
 }
@@ -7,40 +7,94 @@
 #define EMU_WINDOW_H
 
 #include <X11/Xlib.h>
-#include <cairo/cairo.h>
-#include <cairo/cairo-xlib.h>
 #include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "io.h"
+#include "input.h"
+#include "presenter.h"
+#include "recorder.h"
+#include "rewind.h"
+#include "telemetry.h"
 #include "vidmem.h"
 #include "defs.h"
 
-class EmuWindow {
+// How many frames one presenter put in the window and how long that took
+struct EmuPresentTiming {
+  std::string presenter;
+  uint64_t count;
+  uint64_t nanos;
+  uint64_t maxNanos;
+};
+
+class EmuWindow : public EmuIO {
  public:
-  EmuWindow(EmuVideoMemory *vid_mem, const std::string& keymap_filename);
+  EmuWindow(EmuVideoMemory *vid_mem,
+            const std::string& keymap_filename,
+            const EmuPresentMode& present_mode);
   ~EmuWindow();
   void eventLoop();
-  void setPixel(const uint8_t& x,
-                const uint8_t& y,
-                const uint8_t& color);
-  uint16_t getInput(const uint16_t& input_id);
+  EmuVideoMemory *getVideoMemory() { return _vidMem; }
+  uint16_t getInput(const uint16_t& input_id) {
+    return _inputs.get(input_id);
+  }
+  uint32_t getInputGeneration() { return _inputs.getGeneration(); }
+  void waitForInput(const uint32_t& generation,
+                    const std::chrono::steady_clock::time_point& deadline) {
+    _inputs.waitForChange(generation, deadline);
+  }
   bool hasError() { return _error; }
+  void setRefreshRate(const double& hz) { _refreshRate = hz; }
+  // Every frame deadline hands the frame on screen to the recorder
+  void setRecorder(EmuRecorder *recorder) { _recorder = recorder; }
+  // The rewind key steps the processor back through its checkpoints
+  void setRewind(EmuRewind *rewind) { _rewind = rewind; }
+  // Counts frames, draw times and input events for telemetry, and
+  // shows the latest numbers over the frame if asked to
+  void setTelemetry(EmuTelemetry *telemetry, const bool& overlay);
+  void reportPresentTiming(std::ostream& out);
 
  private:
   void _loadKeyMap(const std::string& keymap_filename);
-  void _draw();
+  void _resolveKeyMap();
+  void _handleEvent(XEvent& event, bool& running, bool& full);
+  void _draw(const bool& full);
+  void _drawOverlay();
   void _updateKeyState(const XKeyEvent& event);
+  void _usePresenter(EmuPresenter *presenter);
+  bool _createCairoPresenter();
 
-  cairo_surface_t *_surface;
-  cairo_t *_cairo;
+  EmuPresenter *_presenter;
+  EmuRecorder *_recorder;
+  EmuRewind *_rewind;
+  EmuTelemetry *_telemetry;
   Display *_display;
+  Window _window;
+  // Draws the telemetry overlay, if there is one
+  GC _overlayGC;
   Atom _wmDeleteMessage;
   EmuVideoMemory *_vidMem;
+  // The generation of the last video memory frame drawn
+  uint32_t _drawnGeneration;
+  std::vector<EmuDamage> _damage;
+  // How many frames were presented and how long that took, by each
+  // presenter in the order they were used, the current one last
+  std::vector<EmuPresentTiming> _presentTimings;
+  // Frames per second to present at, the number of frame deadlines
+  // that have passed and how many of them passed while we were busy
+  double _refreshRate;
+  uint64_t _frameTicks;
+  uint64_t _missedDeadlines;
   bool _error;
   int _width;
   int _height;
   // input_id, KeySym
   std::map<uint16_t, KeySym> _keyMap;
-  // KeySym, state
-  std::map<KeySym, uint16_t> _keyState;
+  // The input IDs that each keycode is mapped to
+  std::vector<uint16_t> _keycodeInputs[NUM_KEYCODES];
+  KeyCode _rewindKeycode;
+  EmuInputTable _inputs;
 };
 
 #endif
@@ -0,0 +1,21 @@
+; TIME from the first instruction on: each row gets a pixel at the
+; column TIME reads, with about a virtual millisecond between rows
+    MOVI B, 0
+    MOVI E, 1
+    MOVI F, 3000
+    MOVI H, 192
+    MOVI C, 0xff
+    COLOR C
+row:
+    TIME A
+    PIXEL A, B
+    MOVI C, 0
+wait:
+    ADD C, E
+    CMP C, F
+    JB wait
+    ADD B, E
+    CMP B, H
+    JB row
+done:
+    JMPI done